@@ -0,0 +1,280 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * Options for the generated tree.
+ */
+struct options {
+	/**
+	 * The number of libraries.
+	 */
+	size_t libraries;
+
+	/**
+	 * The number of versions of each library.
+	 */
+	size_t versions;
+
+	/**
+	 * The number of directories in LIBRARIAN_PATH.
+	 */
+	size_t dirs;
+
+	/**
+	 * The minimum size of each librarian file.
+	 */
+	size_t size;
+
+	/**
+	 * The number of layers in the dependency graph.
+	 */
+	size_t depth;
+
+	/**
+	 * The number of dependencies of each library
+	 * that is not in the last layer.
+	 */
+	size_t fanout;
+
+};
+
+
+
+/**
+ * The state of the pseudo-random number generator.
+ */
+static unsigned long long rng_state;
+
+
+
+/**
+ * Get a pseudo-random number.
+ * 
+ * @param   n  The number of possible values.
+ * @return     A number in [0, `n`).
+ */
+static size_t rng(size_t n)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (size_t)(rng_state % n);
+}
+
+
+/**
+ * Get the layer of a library in the dependency graph.
+ * 
+ * @param   opts  The options.
+ * @param   lib   The index of the library.
+ * @return        The layer of the library, 0 for `lib0`.
+ */
+static size_t layer_of(const struct options *opts, size_t lib)
+{
+	return lib * opts->depth / opts->libraries;
+}
+
+
+/**
+ * Get the first library in a layer.
+ * 
+ * @param   opts   The options.
+ * @param   layer  The layer.
+ * @return         The index of the first library in the layer.
+ */
+static size_t layer_start(const struct options *opts, size_t layer)
+{
+	return (layer * opts->libraries + opts->depth - 1) / opts->depth;
+}
+
+
+/**
+ * Write the version string for a version index.
+ * 
+ * @param  f        The file to write to.
+ * @param  version  The index of the version.
+ */
+static void print_version(FILE *f, size_t version)
+{
+	fprintf(f, "%zu.%zu", 1 + version / 8, version % 8);
+}
+
+
+/**
+ * Write a librarian file.
+ * 
+ * Filler variables, `VAR0`, `VAR1`, …, come first so that looking
+ * up `CFLAGS`, `LDFLAGS` and `deps` scans the whole file. Every
+ * dependency accepts the newest version of the library it names,
+ * so `-d` always succeeds without backtracking.
+ * 
+ * @param   opts     The options.
+ * @param   out      The output directory.
+ * @param   lib      The index of the library.
+ * @param   version  The index of the version.
+ * @return           0 on success, -1 on error.
+ */
+static int write_file(const struct options *opts, const char *out, size_t lib, size_t version)
+{
+	char path[4096];
+	FILE *f;
+	size_t i, dep, layer = layer_of(opts, lib), next, count;
+
+	snprintf(path, sizeof(path), "%s/dir%zu/lib%zu=%zu.%zu", out,
+	         (lib + version) % opts->dirs, lib, 1 + version / 8, version % 8);
+	f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+
+	for (i = 0; (i < 16) || (ftell(f) < (long)(opts->size)); i++)
+		fprintf(f, "VAR%zu value-%zu-of-lib%zu-version-%zu-with-some-padding\n", i, i, lib, version);
+
+	fprintf(f, "CFLAGS -DLIB%zu -I/usr/include/lib%zu-", lib, lib);
+	print_version(f, version);
+	fprintf(f, "\nLDFLAGS -llib%zu\n", lib);
+
+	fprintf(f, "deps");
+	if (layer + 1 < opts->depth) {
+		next = layer_start(opts, layer + 1);
+		count = layer_start(opts, layer + 2) - next;
+		for (i = 0; count && i < opts->fanout; i++) {
+			dep = next + rng(count);
+			fprintf(f, " lib%zu", dep);
+			switch (rng(4)) {
+			case 0:
+				break;
+			case 1:
+				fprintf(f, ">=1.0");
+				break;
+			case 2:
+				fprintf(f, "<=");
+				print_version(f, opts->versions - 1);
+				break;
+			default:
+				fprintf(f, ">0.9<");
+				print_version(f, opts->versions);
+				break;
+			}
+		}
+	}
+	fprintf(f, "\n");
+
+	if (ferror(f))
+		return fclose(f), -1;
+	return fclose(f) ? -1 : 0;
+}
+
+
+/**
+ * Parse a numeric option.
+ * 
+ * @param   arg  The argument.
+ * @param   min  The smallest allowed value.
+ * @param   out  Output parameter for the value.
+ * @return       0 on success, -1 if invalid.
+ */
+static int parse_number(const char *arg, size_t min, size_t *out)
+{
+	char *end;
+	unsigned long long value;
+
+	errno = 0;
+	value = strtoull(arg, &end, 10);
+	if (errno || !*arg || *end || (value < min))
+		return -1;
+	*out = (size_t)value;
+	return 0;
+}
+
+
+/**
+ * Generate a synthetic LIBRARIAN_PATH tree.
+ * 
+ * The tree is written to OUTDIR/dir0, OUTDIR/dir1, …,
+ * and the libraries are named lib0, lib1, …, with lib0
+ * at the root of the dependency graph.
+ * 
+ * @return  0: Successful.
+ *          1: An error occurred.
+ *          3: Usage error.
+ */
+int main(int argc, char *argv[])
+{
+	struct options opts = {1000, 4, 4, 256, 6, 3};
+	char path[4096];
+	size_t i, v, seed = 1;
+	int c, r = 0;
+
+	while ((c = getopt(argc, argv, "L:V:D:s:h:f:S:")) != -1) {
+		switch (c) {
+		case 'L':  r |= parse_number(optarg, 1, &opts.libraries);  break;
+		case 'V':  r |= parse_number(optarg, 1, &opts.versions);   break;
+		case 'D':  r |= parse_number(optarg, 1, &opts.dirs);       break;
+		case 's':  r |= parse_number(optarg, 0, &opts.size);       break;
+		case 'h':  r |= parse_number(optarg, 1, &opts.depth);      break;
+		case 'f':  r |= parse_number(optarg, 0, &opts.fanout);     break;
+		case 'S':  r |= parse_number(optarg, 1, &seed);            break;
+		default:   r = -1;                                         break;
+		}
+	}
+	if (r || (optind + 1 != argc)) {
+		fprintf(stderr, "usage: %s [-L libraries] [-V versions] [-D dirs] [-s size] "
+		                "[-h depth] [-f fanout] [-S seed] outdir\n", *argv);
+		return 3;
+	}
+	if (opts.depth > opts.libraries)
+		opts.depth = opts.libraries;
+	rng_state = (unsigned long long)seed * 0x9E3779B97F4A7C15ULL;
+
+	if (mkdir(argv[optind], 0777) && (errno != EEXIST))
+		goto fail;
+	for (i = 0; i < opts.dirs; i++) {
+		snprintf(path, sizeof(path), "%s/dir%zu", argv[optind], i);
+		if (mkdir(path, 0777) && (errno != EEXIST))
+			goto fail;
+	}
+	for (i = 0; i < opts.libraries; i++)
+		for (v = 0; v < opts.versions; v++)
+			if (write_file(&opts, argv[optind], i, v))
+				goto fail;
+
+	printf("LIBRARIAN_PATH=");
+	for (i = 0; i < opts.dirs; i++)
+		printf("%s%s/dir%zu", i ? ":" : "", argv[optind], i);
+	printf("\n");
+	return 0;
+
+fail:
+	perror(*argv);
+	return 1;
+}
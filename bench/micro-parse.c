@@ -0,0 +1,121 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include "../src/liblibrarian.c"
+#include "micro.h"
+
+
+
+/**
+ * Every library specification form in the README.
+ */
+static const char *const forms[][2] = {
+	{"name",          "libfoo"},
+	{"name=version",  "libfoo=1:2.4.31"},
+	{"name<=max",     "libfoo<=2.4.31"},
+	{"name<max",      "libfoo<3"},
+	{"name>=min",     "libfoo>=1.0"},
+	{"name>min",      "libfoo>1.0rc1"},
+	{"name>=min<=max", "libfoo>=1.0<=2.4.31"},
+	{"name>=min<max", "libfoo>=1.0<2"},
+	{"name>min<=max", "libfoo>1.0<=2.4.31"},
+	{"name>min<max",  "libfoo>1.0<2.0.0.0.0.0.0.1"},
+};
+
+/**
+ * Variable names and libraries for librarian_is_variable().
+ */
+static const char *const words[] = {
+	"CFLAGS", "LDFLAGS", "CPPFLAGS", "MY_VAR-2", "X11",
+	"libfoo", "foo>=1.0", "Qt5Core", "gtk+-3.0", "ZLIB_VERSION_STRING_LONG",
+};
+
+/**
+ * The specification being parsed.
+ */
+static const char *form;
+
+/**
+ * The length of `form`.
+ */
+static size_t form_len;
+
+
+
+/**
+ * Benchmark parse_library() and free_library(). The
+ * specification is copied before each parse, since
+ * parse_library() modifies it.
+ * 
+ * @param  ctx         Not used.
+ * @param  iterations  The number of iterations.
+ */
+static void bench_parse(void *ctx, size_t iterations)
+{
+	struct library lib;
+	char buf[128];
+
+	(void) ctx;
+	while (iterations--) {
+		memcpy(buf, form, form_len + 1);
+		if (parse_library(buf, &lib))
+			abort();
+		micro_sink += lib.lower_closed;
+		free_library(&lib);
+	}
+}
+
+
+/**
+ * Benchmark librarian_is_variable().
+ * 
+ * @param  ctx         Not used.
+ * @param  iterations  The number of iterations.
+ */
+static void bench_is_variable(void *ctx, size_t iterations)
+{
+	size_t i;
+
+	(void) ctx;
+	while (iterations--)
+		for (i = 0; i < sizeof(words) / sizeof(*words); i++)
+			micro_sink += (size_t)librarian_is_variable(words[i]);
+}
+
+
+int main(void)
+{
+	char name[64];
+	size_t i;
+
+	micro_init();
+	for (i = 0; i < sizeof(forms) / sizeof(*forms); i++) {
+		form = forms[i][1];
+		form_len = strlen(form);
+		snprintf(name, sizeof(name), "parse/%s", forms[i][0]);
+		micro_run(name, bench_parse, NULL, 1);
+	}
+	micro_run("is_variable", bench_is_variable, NULL, sizeof(words) / sizeof(*words));
+	return 0;
+}
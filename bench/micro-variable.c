@@ -0,0 +1,161 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include "../src/liblibrarian.c"
+#include "micro.h"
+
+
+
+/**
+ * A librarian file in memory.
+ */
+struct content {
+	/**
+	 * The content.
+	 */
+	char *data;
+
+	/**
+	 * The size of `data`.
+	 */
+	size_t size;
+
+	/**
+	 * The variable to look up.
+	 */
+	const char *var;
+
+	/**
+	 * An indexed file with the content.
+	 */
+	struct parsed_file *file;
+};
+
+
+
+/**
+ * Create the content of a librarian file with filler
+ * variables, `VAR0`, `VAR1`, …, and then `CFLAGS`
+ * and `LDFLAGS`.
+ * 
+ * @param   c      Output parameter for the content.
+ * @param   lines  The number of filler variables.
+ */
+static void make_content(struct content *c, size_t lines)
+{
+	size_t i, size = 64 * (lines + 2);
+	char *p;
+
+	p = c->data = malloc(size);
+	if (p == NULL)
+		abort();
+	for (i = 0; i < lines; i++)
+		p += sprintf(p, "VAR%zu value-%zu-with-some-padding\n", i, i);
+	p += sprintf(p, "CFLAGS -DFOO -I/usr/include/foo\nLDFLAGS -lfoo\n");
+	c->size = (size_t)(p - c->data);
+
+	c->file = new_parsed_file("/dev/null");
+	if (c->file == NULL)
+		abort();
+	c->file->data = c->data;
+	c->file->size = c->size;
+	while (c->file->scanned < c->file->size)
+		if (!index_line(c->file) && errno)
+			abort();
+}
+
+
+/**
+ * Benchmark find_variable() on a file that has just been
+ * loaded, so that the lookup indexes the file up to the
+ * variable. The file is recreated for each lookup.
+ * 
+ * @param  ctx:struct content *  The file and variable.
+ * @param  iterations            The number of iterations.
+ */
+static void bench_fresh(void *ctx, size_t iterations)
+{
+	struct content *c = ctx;
+	struct parsed_file *file;
+	const struct variable *var;
+
+	while (iterations--) {
+		file = new_parsed_file("/dev/null");
+		if (file == NULL)
+			abort();
+		file->data = c->data;
+		file->size = c->size;
+		var = find_variable(file, c->var);
+		micro_sink += var ? var->value_len : 0;
+		file->data = NULL;
+		free_parsed_file(file);
+	}
+}
+
+
+/**
+ * Benchmark find_variable() on a fully indexed file.
+ * 
+ * @param  ctx:struct content *  The file and variable.
+ * @param  iterations            The number of iterations.
+ */
+static void bench_indexed(void *ctx, size_t iterations)
+{
+	struct content *c = ctx;
+	const struct variable *var;
+
+	while (iterations--) {
+		var = find_variable(c->file, c->var);
+		micro_sink += var ? var->value_len : 0;
+	}
+}
+
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		size_t lines;
+	} sizes[] = {{"small", 6}, {"large", 20000}};
+	static const char *const vars[] = {"VAR0", "CFLAGS", "MISSING"};
+	struct content c;
+	char name[64];
+	size_t i, j;
+
+	micro_init();
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		make_content(&c, sizes[i].lines);
+		for (j = 0; j < sizeof(vars) / sizeof(*vars); j++) {
+			c.var = vars[j];
+			snprintf(name, sizeof(name), "fresh/%s/%s", sizes[i].name, vars[j]);
+			micro_run(name, bench_fresh, &c, 1);
+			snprintf(name, sizeof(name), "indexed/%s/%s", sizes[i].name, vars[j]);
+			micro_run(name, bench_indexed, &c, 1);
+		}
+		c.file->data = NULL;
+		free_parsed_file(c.file);
+		free(c.data);
+	}
+	return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include "../src/liblibrarian.c"
+#include "micro.h"
+
+
+
+/**
+ * A set of version pairs to compare.
+ */
+struct corpus {
+	/**
+	 * The name of the set.
+	 */
+	const char *name;
+
+	/**
+	 * The pairs, terminated by `{NULL, NULL}`.
+	 */
+	const char *pairs[8][2];
+};
+
+
+
+/**
+ * The fixed corpora.
+ */
+static const struct corpus corpora[] = {
+	{"short", {
+		{"1.0", "1.1"}, {"2.4", "2.4"}, {"0.9", "1.0"}, {"10", "9"}, {NULL, NULL}}},
+	{"long-numeric", {
+		{"1.000000000000000000000000000000123", "1.000000000000000000000000000000124"},
+		{"20240229123059000000000001", "20240229123059000000000002"},
+		{"1.99999999999999999999999999999999", "2.0"},
+		{"123456789012345678901234567890", "123456789012345678901234567890"},
+		{NULL, NULL}}},
+	{"epoch", {
+		{"1:1.0", "2:0.9"}, {"3:2.7.1-r4", "3:2.7.1-r5"},
+		{"0:1.0", "1.0"}, {"12:4.2rc1", "12:4.2"}, {NULL, NULL}}},
+	{"many-segments", {
+		{"1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16", "1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.17"},
+		{"0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1", "0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.1"},
+		{"2016.01.02.03.04.05.06.07", "2016.01.02.03.04.05.06.07"},
+		{NULL, NULL}}},
+	{"alpha", {
+		{"1.0rc1", "1.0"}, {"1.0-beta2", "1.0-beta10"},
+		{"2.4.31a", "2.4.31b"}, {"r1234", "r999"}, {NULL, NULL}}},
+};
+
+/**
+ * The corpus being benchmarked.
+ */
+static const struct corpus *corpus;
+
+/**
+ * The number of pairs in `corpus`.
+ */
+static size_t pairs;
+
+/**
+ * Prebuilt keys for `corpus`.
+ */
+static struct version_key keys[8][2];
+
+
+
+/**
+ * Benchmark make_version_key() and free_version_key().
+ * 
+ * @param  ctx         Not used.
+ * @param  iterations  The number of iterations.
+ */
+static void bench_make(void *ctx, size_t iterations)
+{
+	struct version_key key;
+	size_t i, j;
+
+	(void) ctx;
+	while (iterations--) {
+		for (i = 0; i < pairs; i++) {
+			for (j = 0; j < 2; j++) {
+				if (make_version_key(&key, corpus->pairs[i][j]))
+					abort();
+				micro_sink += key.count;
+				free_version_key(&key);
+			}
+		}
+	}
+}
+
+
+/**
+ * Benchmark version_key_cmp() on prebuilt keys.
+ * 
+ * @param  ctx         Not used.
+ * @param  iterations  The number of iterations.
+ */
+static void bench_cmp(void *ctx, size_t iterations)
+{
+	size_t i;
+
+	(void) ctx;
+	while (iterations--)
+		for (i = 0; i < pairs; i++)
+			micro_sink += (size_t)version_key_cmp(keys[i] + 0, keys[i] + 1);
+}
+
+
+/**
+ * Benchmark comparing version strings, that is, making
+ * both keys and comparing them, as update_best() does.
+ * 
+ * @param  ctx         Not used.
+ * @param  iterations  The number of iterations.
+ */
+static void bench_full(void *ctx, size_t iterations)
+{
+	struct version_key a, b;
+	size_t i;
+
+	(void) ctx;
+	while (iterations--) {
+		for (i = 0; i < pairs; i++) {
+			if (make_version_key(&a, corpus->pairs[i][0]) || make_version_key(&b, corpus->pairs[i][1]))
+				abort();
+			micro_sink += (size_t)version_key_cmp(&a, &b);
+			free_version_key(&a);
+			free_version_key(&b);
+		}
+	}
+}
+
+
+int main(void)
+{
+	char name[64];
+	size_t c, i;
+
+	micro_init();
+	for (c = 0; c < sizeof(corpora) / sizeof(*corpora); c++) {
+		corpus = corpora + c;
+		for (pairs = 0; corpus->pairs[pairs][0]; pairs++)
+			if (make_version_key(keys[pairs] + 0, corpus->pairs[pairs][0]) ||
+			    make_version_key(keys[pairs] + 1, corpus->pairs[pairs][1]))
+				return perror("micro-version"), 1;
+
+		snprintf(name, sizeof(name), "key/%s", corpus->name);
+		micro_run(name, bench_make, NULL, 2 * pairs);
+		snprintf(name, sizeof(name), "cmp/%s", corpus->name);
+		micro_run(name, bench_cmp, NULL, pairs);
+		snprintf(name, sizeof(name), "key+cmp/%s", corpus->name);
+		micro_run(name, bench_full, NULL, pairs);
+
+		for (i = 0; i < pairs; i++) {
+			free_version_key(keys[i] + 0);
+			free_version_key(keys[i] + 1);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,234 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Support for the microbenchmarks in bench/micro-*.c. Each
+ * microbenchmark includes src/liblibrarian.c, to reach its static
+ * functions, and must be linked with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so that
+ * allocations can be counted.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+#endif
+
+
+
+/**
+ * The number of seconds each benchmark should run for.
+ */
+#define MICRO_SECONDS  0.2
+
+/**
+ * The number of hardware counters.
+ */
+#define MICRO_COUNTERS  4
+
+
+
+/**
+ * The number of allocations made since it was reset.
+ */
+static volatile unsigned long long micro_allocations = 0;
+
+/**
+ * Benchmarks add their results here, so
+ * that they cannot be optimised away.
+ */
+static volatile size_t micro_sink = 0;
+
+/**
+ * The file descriptors of the hardware counters,
+ * -1 for unavailable counters. The first is the
+ * group leader.
+ */
+static int micro_fds[MICRO_COUNTERS] = {-1, -1, -1, -1};
+
+/**
+ * The names of the hardware counters.
+ */
+static const char *const micro_counter_names[MICRO_COUNTERS] = {
+	"cycles", "instrs", "br-miss", "cache-miss"
+};
+
+
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+
+/**
+ * Counting wrapper for malloc(3).
+ */
+void *__wrap_malloc(size_t size)
+{
+	micro_allocations++;
+	return __real_malloc(size);
+}
+
+
+/**
+ * Counting wrapper for calloc(3).
+ */
+void *__wrap_calloc(size_t n, size_t size)
+{
+	micro_allocations++;
+	return __real_calloc(n, size);
+}
+
+
+/**
+ * Counting wrapper for realloc(3).
+ */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	micro_allocations++;
+	return __real_realloc(ptr, size);
+}
+
+
+/**
+ * Open the hardware counters that are available, through
+ * perf_event_open(2), and print the table header.
+ */
+static void micro_init(void)
+{
+#ifdef __linux__
+	static const unsigned long long configs[MICRO_COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+	};
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < MICRO_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.disabled = !i;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		micro_fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, i ? micro_fds[0] : -1, 0);
+		if (micro_fds[0] < 0)
+			break;
+	}
+#endif
+
+	printf("%-28s  %10s  %10s", "benchmark", "ns/op", "allocs/op");
+	for (int i = 0; i < MICRO_COUNTERS; i++)
+		printf("  %10s", micro_counter_names[i]);
+	printf("\n");
+}
+
+
+/**
+ * Get the time.
+ * 
+ * @return  The time, in seconds, of a monotonic clock.
+ */
+static double micro_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Run a benchmark and print its results.
+ * 
+ * The number of iterations is first doubled until the
+ * benchmark runs for a noticeable time, and then scaled
+ * so that the measured run takes about `MICRO_SECONDS`.
+ * 
+ * @param  name  The name of the benchmark.
+ * @param  fn    The benchmark, shall run `iterations`
+ *               iterations with `ctx`.
+ * @param  ctx   User-defined data for `fn`.
+ * @param  ops   The number of operations per iteration.
+ */
+static void micro_run(const char *name, void (*fn)(void *ctx, size_t iterations), void *ctx, size_t ops)
+{
+	uint64_t values[1 + MICRO_COUNTERS];
+	uint64_t counts[MICRO_COUNTERS];
+	size_t iterations = 1;
+	double start, elapsed, total;
+	unsigned long long allocations;
+	int i, j, have = 0;
+
+	for (;;) {
+		start = micro_now();
+		fn(ctx, iterations);
+		elapsed = micro_now() - start;
+		if ((elapsed >= MICRO_SECONDS / 20) || (iterations >= ((size_t)1 << 40)))
+			break;
+		iterations <<= 1;
+	}
+	if (elapsed < MICRO_SECONDS)
+		iterations = (size_t)((double)iterations * (MICRO_SECONDS / (elapsed > 0 ? elapsed : 1e-9)));
+	iterations += !iterations;
+
+	memset(counts, 0, sizeof(counts));
+#ifdef __linux__
+	if (micro_fds[0] >= 0) {
+		ioctl(micro_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(micro_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+#endif
+	micro_allocations = 0;
+	start = micro_now();
+	fn(ctx, iterations);
+	elapsed = micro_now() - start;
+	allocations = micro_allocations;
+#ifdef __linux__
+	if (micro_fds[0] >= 0) {
+		ioctl(micro_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		if (read(micro_fds[0], values, sizeof(values)) > 0) {
+			/* values[0] is the number of counters in the group, in opening order. */
+			for (i = j = 0; i < MICRO_COUNTERS && (uint64_t)j < values[0]; i++)
+				if (micro_fds[i] >= 0)
+					counts[i] = values[1 + j++];
+			have = 1;
+		}
+	}
+#endif
+
+	total = (double)iterations * (double)ops;
+	printf("%-28s  %10.2f  %10.2f", name, elapsed * 1e9 / total, (double)allocations / total);
+	for (i = 0; i < MICRO_COUNTERS; i++) {
+		if (have && (micro_fds[i] >= 0))
+			printf("  %10.2f", (double)counts[i] / total);
+		else
+			printf("  %10s", "-");
+	}
+	printf("\n");
+}
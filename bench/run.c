@@ -0,0 +1,426 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+# include <sys/ptrace.h>
+#endif
+
+
+
+/**
+ * The maximum number of arguments in a scenario.
+ */
+#define MAX_ARGS  32
+
+
+
+/**
+ * A benchmarked invocation of librarian.
+ */
+struct scenario {
+	/**
+	 * The name of the scenario.
+	 */
+	const char *name;
+
+	/**
+	 * The arguments, excluding the command
+	 * name, terminated by `NULL`.
+	 */
+	const char *args[MAX_ARGS];
+};
+
+
+
+/**
+ * The benchmarked invocations.
+ */
+static const struct scenario scenarios[] = {
+	{"lookup",    {"CFLAGS", "lib0", NULL}},
+	{"locate",    {"-l", "lib0", "lib1", "lib2", "lib3", NULL}},
+	{"deps",      {"-d", "CFLAGS", "LDFLAGS", "lib0", NULL}},
+	{"oldest",    {"-o", "CFLAGS", "lib0", "lib1", NULL}},
+	{"variables", {"VAR0", "VAR1", "VAR2", "VAR3", "VAR4", "VAR5", "VAR6", "VAR7",
+	               "VAR8", "VAR9", "VAR10", "VAR11", "VAR12", "VAR13", "VAR14",
+	               "VAR15", "CFLAGS", "LDFLAGS", "lib0", "lib1", "lib2", "lib3", NULL}},
+};
+
+/**
+ * The generated tree.
+ */
+static const char *tree;
+
+/**
+ * The number of directories in the tree.
+ */
+static size_t dirs_count;
+
+/**
+ * Shall all of the system's caches be dropped,
+ * rather than only the pages of the tree's files?
+ */
+static int drop_caches;
+
+/**
+ * The environment of librarian.
+ */
+static char *envp[4];
+
+
+
+extern char **environ;
+
+
+
+/**
+ * Compare two latencies.
+ * 
+ * @param   a:const double *  One of the latencies.
+ * @param   b:const double *  The other latency.
+ * @return                    <0: `a` < `b`.
+ *                            =0: `a` = `b`.
+ *                            >0: `a` > `b`.
+ */
+static int double_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Evict the tree from the page cache. The pages of the
+ * files are dropped with posix_fadvise(3), which leaves
+ * directories and inodes cached. Only if `drop_caches`
+ * is set, all of the system's caches are dropped, which
+ * requires root and affects every process on the machine.
+ * 
+ * @return  "drop_caches", "fadvise" or "none",
+ *          depending on what worked.
+ */
+static const char *evict(void)
+{
+	char path[4096];
+	DIR *d;
+	struct dirent *f;
+	size_t i;
+	int fd, ok = 0;
+
+	if (drop_caches) {
+		sync();
+		fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+		if (fd >= 0) {
+			ok = write(fd, "3\n", 2) == 2;
+			close(fd);
+			if (ok)
+				return "drop_caches";
+		}
+	}
+
+	for (i = 0; i < dirs_count; i++) {
+		snprintf(path, sizeof(path), "%s/dir%zu", tree, i);
+		d = opendir(path);
+		if (d == NULL)
+			continue;
+		while ((f = readdir(d))) {
+			if (*f->d_name == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/dir%zu/%s", tree, i, f->d_name);
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				continue;
+			ok |= !posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+		closedir(d);
+	}
+	return ok ? "fadvise" : "none";
+}
+
+
+/**
+ * Start librarian.
+ * 
+ * @param   bin    The pathname of librarian.
+ * @param   s      The scenario.
+ * @param   trace  Shall the child be traced?
+ * @return         The process ID, -1 on error.
+ */
+static pid_t start(const char *bin, const struct scenario *s, int trace)
+{
+	const char *argv[MAX_ARGS + 1];
+	pid_t pid;
+	size_t i;
+	int fd;
+
+	argv[0] = bin;
+	for (i = 0; s->args[i]; i++)
+		argv[i + 1] = s->args[i];
+	argv[i + 1] = NULL;
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+#ifdef __linux__
+	if (trace) {
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+			_exit(126);
+		raise(SIGSTOP);
+	}
+#else
+	(void) trace;
+#endif
+	execve(bin, (char **)argv, envp);
+	_exit(127);
+}
+
+
+/**
+ * Run librarian once and time it.
+ * 
+ * @param   bin  The pathname of librarian.
+ * @param   s    The scenario.
+ * @return       The latency in milliseconds, -1 on failure.
+ */
+static double run_once(const char *bin, const struct scenario *s)
+{
+	struct timespec begin, end;
+	pid_t pid;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	pid = start(bin, s, 0);
+	if (pid < 0)
+		return -1;
+	if (waitpid(pid, &status, 0) != pid)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+
+	return (double)(end.tv_sec - begin.tv_sec) * 1000.0 +
+	       (double)(end.tv_nsec - begin.tv_nsec) / 1000000.0;
+}
+
+
+/**
+ * Count the system calls librarian makes,
+ * in all of its threads, by tracing it.
+ * 
+ * @param   bin  The pathname of librarian.
+ * @param   s    The scenario.
+ * @return       The number of system calls, -1 if
+ *               tracing is not possible.
+ */
+static long count_syscalls(const char *bin, const struct scenario *s)
+{
+#ifdef __linux__
+	long stops = 0;
+	pid_t pid, w;
+	int status, sig;
+
+	pid = start(bin, s, 1);
+	if (pid < 0)
+		return -1;
+	if ((waitpid(pid, &status, 0) != pid) || !WIFSTOPPED(status))
+		return -1;
+	if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD |
+	           PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL))) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+		return -1;
+	}
+	ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+	while ((w = waitpid(-1, &status, __WALL)) > 0) {
+		if (!WIFSTOPPED(status))
+			continue;
+		sig = WSTOPSIG(status);
+		if (sig == (SIGTRAP | 0x80))
+			stops++, sig = 0;
+		else if ((sig == SIGTRAP) || (sig == SIGSTOP))
+			sig = 0;
+		ptrace(PTRACE_SYSCALL, w, NULL, (void *)(long)sig);
+	}
+
+	/* Each system call stops on entry and exit, except the last. */
+	return (stops + 1) / 2;
+#else
+	(void) bin;
+	(void) s;
+	return -1;
+#endif
+}
+
+
+/**
+ * Benchmark a scenario and print the result.
+ * 
+ * @param   bin   The pathname of librarian.
+ * @param   s     The scenario.
+ * @param   runs  The number of timed runs.
+ * @param   cold  Shall the tree be evicted before each run?
+ * @return        0 on success, -1 if librarian failed.
+ */
+static int bench(const char *bin, const struct scenario *s, size_t runs, int cold)
+{
+	double *times = malloc(runs * sizeof(*times));
+	size_t i;
+	long syscalls;
+
+	if (times == NULL)
+		return -1;
+	if (!cold && (run_once(bin, s) < 0))
+		goto fail;
+	for (i = 0; i < runs; i++) {
+		if (cold)
+			evict();
+		times[i] = run_once(bin, s);
+		if (times[i] < 0)
+			goto fail;
+	}
+	qsort(times, runs, sizeof(*times), double_cmp);
+	syscalls = cold ? -1 : count_syscalls(bin, s);
+
+	printf("%-10s  %-4s  %6zu  %10.3f  %10.3f  ", s->name, cold ? "cold" : "warm",
+	       runs, times[(runs - 1) / 2], times[(runs - 1) * 99 / 100]);
+	if (syscalls < 0)
+		printf("%8s\n", "-");
+	else
+		printf("%8li\n", syscalls);
+	free(times);
+	return 0;
+
+fail:
+	fprintf(stderr, "bench: %s: librarian failed\n", s->name);
+	free(times);
+	return -1;
+}
+
+
+/**
+ * Time representative invocations of librarian on a tree
+ * generated by bench-generate, with warm and cold caches.
+ * The system call counts are for one warm run. Cold runs
+ * evict only the tree, unless BENCH_DROP_CACHES=1 is set
+ * in the environment.
+ * 
+ * @return  0: Successful.
+ *          1: An error occurred.
+ *          3: Usage error.
+ */
+int main(int argc, char *argv[])
+{
+	const char *bin = "bin/librarian";
+	size_t runs = 200, cold_runs = 20, i;
+	char *path = NULL;
+	char *p;
+	char **env;
+	char dir[4096];
+	struct stat st;
+	int c, rc = 0, e = 1, have_jobs = 0, have_index = 0;
+
+	while ((c = getopt(argc, argv, "b:n:c:")) != -1) {
+		switch (c) {
+		case 'b':  bin = optarg;                                  break;
+		case 'n':  runs = (size_t)strtoul(optarg, NULL, 10);      break;
+		case 'c':  cold_runs = (size_t)strtoul(optarg, NULL, 10); break;
+		default:   goto usage;
+		}
+	}
+	if ((optind + 1 != argc) || !runs)
+		goto usage;
+	tree = argv[optind];
+
+	/* Build LIBRARIAN_PATH from the tree. */
+	for (;; dirs_count++) {
+		snprintf(dir, sizeof(dir), "%s/dir%zu", tree, dirs_count);
+		if (stat(dir, &st))
+			break;
+	}
+	if (!dirs_count) {
+		fprintf(stderr, "%s: %s: %s\n", *argv, dir, strerror(errno));
+		return 1;
+	}
+	path = malloc(sizeof("LIBRARIAN_PATH=") + dirs_count * (strlen(tree) + 3 * sizeof(size_t) + sizeof("/dir:")));
+	if (path == NULL)
+		goto fail;
+	p = stpcpy(path, "LIBRARIAN_PATH=");
+	for (i = 0; i < dirs_count; i++)
+		p += sprintf(p, "%s%s/dir%zu", i ? ":" : "", tree, i);
+
+	/* librarian must not use a daemon, but may use LIBRARIAN_JOBS and LIBRARIAN_INDEX,
+	 * only their first occurrences, as getenv(3) would, so that `envp` does not overflow. */
+	envp[0] = path;
+	for (env = environ; *env; env++) {
+		if (!have_jobs && !strncmp(*env, "LIBRARIAN_JOBS=", 15))
+			envp[e++] = *env, have_jobs = 1;
+		else if (!have_index && !strncmp(*env, "LIBRARIAN_INDEX=", 16))
+			envp[e++] = *env, have_index = 1;
+	}
+	envp[e] = NULL;
+
+	p = getenv("BENCH_DROP_CACHES");
+	drop_caches = p && !strcmp(p, "1");
+	if (drop_caches && cold_runs)
+		fprintf(stderr, "%s: warning: BENCH_DROP_CACHES=1, dropping the caches of the whole system\n", *argv);
+
+	printf("# %zu directories, cold runs evict with %s\n", dirs_count, cold_runs ? evict() : "none");
+	printf("%-10s  %-4s  %6s  %10s  %10s  %8s\n", "scenario", "mode", "runs", "p50 (ms)", "p99 (ms)", "syscalls");
+	for (i = 0; i < sizeof(scenarios) / sizeof(*scenarios); i++) {
+		rc |= bench(bin, scenarios + i, runs, 0);
+		if (cold_runs)
+			rc |= bench(bin, scenarios + i, cold_runs, 1);
+	}
+
+	free(path);
+	return rc ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-b librarian] [-n runs] [-c cold-runs] tree\n", *argv);
+	return 3;
+
+fail:
+	perror(*argv);
+	free(path);
+	return 1;
+}
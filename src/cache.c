@@ -0,0 +1,507 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+
+/**
+ * The header of a cache file.
+ * 
+ * A cache file is followed by `stamps` `struct cache_stamp`:s,
+ * the key, the pathnames of the stamped directories and files
+ * as NUL-terminated strings, in the same order as the stamps,
+ * and then the output and the error output of the query.
+ */
+struct cache_header {
+	/**
+	 * Shall be `CACHE_MAGIC`.
+	 */
+	char magic[8];
+
+	/**
+	 * The exit status of the query.
+	 */
+	int64_t status;
+
+	/**
+	 * The number of stamps.
+	 */
+	uint64_t stamps;
+
+	/**
+	 * The size of the key.
+	 */
+	uint64_t key_size;
+
+	/**
+	 * The total size of the pathnames.
+	 */
+	uint64_t paths_size;
+
+	/**
+	 * The size of the output.
+	 */
+	uint64_t out_size;
+
+	/**
+	 * The size of the error output.
+	 */
+	uint64_t err_size;
+};
+
+
+/**
+ * The state of a directory or file the result
+ * of a query depends on. All zeroes if the
+ * directory or file does not exist.
+ */
+struct cache_stamp {
+	/**
+	 * The device the directory or file is stored on.
+	 */
+	uint64_t dev;
+
+	/**
+	 * The inode number of the directory or file.
+	 */
+	uint64_t ino;
+
+	/**
+	 * The size of the directory or file.
+	 */
+	uint64_t size;
+
+	/**
+	 * The last modification time,
+	 * seconds and nanoseconds.
+	 */
+	int64_t mtime[2];
+
+	/**
+	 * The last status change time,
+	 * seconds and nanoseconds.
+	 */
+	int64_t ctime[2];
+};
+
+
+
+/**
+ * Value of `struct cache_header.magic`.
+ */
+#define CACHE_MAGIC  "LIBRCCH1"
+
+
+
+/**
+ * Create the key of a query, that is, the process name,
+ * the options, normalised, the other arguments, and
+ * LIBRARIAN_PATH, each followed by a NUL byte. The process
+ * name is included because it appears in error messages.
+ * If a database is embedded, its size and hash follow, as
+ * its files are not stamped, and a rebuilt librarian may
+ * embed a different database for the same directory.
+ * 
+ * @param   argc  The number of elements in `argv`.
+ * @param   argv  The command line, including the process name.
+ * @param   path  LIBRARIAN_PATH.
+ * @param   len   Output parameter for the size of the key.
+ * @return        The key, `NULL` on error or if the arguments
+ *                are invalid.
+ */
+static char *make_key(int argc, char *argv[], const char *path, size_t *len)
+{
+	int dashed = 0, f_deps = 0, f_locate = 0, f_oldest = 0, f_list = 0, f_probe = 0, format = 0, i;
+	const char *arg;
+	char *key;
+	char *p;
+
+	*len = strlen(argc ? *argv : "") + strlen(path) + sizeof("-dlLPos") + 1;
+#ifdef EMBED
+	*len += 3 * sizeof(size_t) + sizeof(":0123456789abcdef");
+#endif
+	for (i = 1; i < argc; i++) {
+		arg = argv[i];
+		if (!dashed && !strcmp(arg, "--")) {
+			dashed = 1;
+		} else if (!dashed && !strcmp(arg, "--list")) {
+			f_list = 1;
+		} else if (!dashed && !strcmp(arg, "--probe")) {
+			f_probe = 1;
+		} else if (!dashed && (*arg == '-')) {
+			if (!*++arg)
+				return NULL;
+			for (; *arg; arg++) {
+				if      (*arg == 'd')  f_deps = 1;
+				else if (*arg == 'l')  f_locate = 1;
+				else if (*arg == 'o')  f_oldest = 1;
+				else if (strchr("msz", *arg) && (!format || (format == *arg)))
+					format = *arg;
+				else
+					return NULL;
+			}
+		} else {
+			*len += strlen(arg) + 1;
+		}
+	}
+
+	p = key = malloc(*len);
+	if (key == NULL)
+		return NULL;
+	p = stpcpy(p, argc ? *argv : "") + 1;
+	*p++ = '-';
+	if (f_deps)    *p++ = 'd';
+	if (f_locate)  *p++ = 'l';
+	if (f_list)    *p++ = 'L';
+	if (f_probe)   *p++ = 'P';
+	if (f_oldest)  *p++ = 'o';
+	if (format)    *p++ = (char)format;
+	*p++ = '\0';
+	for (dashed = 0, i = 1; i < argc; i++) {
+		if (!dashed && !strcmp(argv[i], "--"))
+			dashed = 1;
+		else if (dashed || (*argv[i] != '-'))
+			p = stpcpy(p, argv[i]) + 1;
+	}
+	p = stpcpy(p, path) + 1;
+#ifdef EMBED
+	p += sprintf(p, "%zu:%016llx", embedded_db_size, (unsigned long long int)embedded_db_hash) + 1;
+#endif
+	*len = (size_t)(p - key);
+	return key;
+}
+
+
+/**
+ * Get the pathname of the cache file for a query.
+ * 
+ * @param   dir  The cache directory.
+ * @param   key  The key of the query.
+ * @param   len  The size of `key`.
+ * @return       The pathname of the cache file, `NULL` on error.
+ */
+static char *cache_file(const char *dir, const char *key, size_t len)
+{
+	uint64_t h = UINT64_C(0xCBF29CE484222325);
+	char *rc;
+
+	while (len--)
+		h = (h ^ (unsigned char)*key++) * UINT64_C(0x100000001B3);
+	rc = malloc(strlen(dir) + 18);
+	if (rc != NULL)
+		sprintf(rc, "%s/%016llx", dir, (unsigned long long int)h);
+	return rc;
+}
+
+
+/**
+ * Get the state of a directory or file.
+ * 
+ * @param  path   The pathname of the directory or file.
+ * @param  stamp  Output parameter for the state.
+ */
+static void get_stamp(const char *path, struct cache_stamp *stamp)
+{
+	struct stat st;
+
+	memset(stamp, 0, sizeof(*stamp));
+	if (stat(path, &st))
+		return;
+	stamp->dev = (uint64_t)(st.st_dev);
+	stamp->ino = (uint64_t)(st.st_ino);
+	stamp->size = (uint64_t)(st.st_size);
+	stamp->mtime[0] = (int64_t)(st.st_mtim.tv_sec);
+	stamp->mtime[1] = (int64_t)(st.st_mtim.tv_nsec);
+	stamp->ctime[0] = (int64_t)(st.st_ctim.tv_sec);
+	stamp->ctime[1] = (int64_t)(st.st_ctim.tv_nsec);
+}
+
+
+/**
+ * Write data to a file, completely.
+ * 
+ * @param   fd    The file descriptor.
+ * @param   data  The data.
+ * @param   size  The size of `data`.
+ * @return        0 on success, -1 on error.
+ */
+static int write_all(int fd, const char *data, size_t size)
+{
+	ssize_t n;
+
+	for (; size; data += n, size -= (size_t)n) {
+		n = write(fd, data, size);
+		if (n < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Answer a query from the result cache, if the result of
+ * the query is cached and nothing it depends on has been
+ * modified since.
+ * 
+ * @param   dir     The cache directory.
+ * @param   argc    The number of elements in `argv`.
+ * @param   argv    The command line, including the process name.
+ * @param   path    LIBRARIAN_PATH.
+ * @param   dep     The depfile to write, `NULL` if none.
+ * @param   status  Output parameter for the exit status of the query.
+ * @return          0 if the query was answered, -1 otherwise.
+ */
+int cache_lookup(const char *dir, int argc, char *argv[], const char *path, const struct depfile *dep,
+                 int *status)
+{
+	struct cache_header head;
+	struct cache_stamp stamp;
+	struct cache_stamp *stamps;
+	const char **paths = NULL;
+	char *key;
+	char *file = NULL;
+	char *data = NULL;
+	char *p;
+	char *end;
+	size_t len, size, i;
+	struct stat st;
+	ssize_t n;
+	int fd = -1;
+
+	key = make_key(argc, argv, path, &len);
+	t (key == NULL);
+	file = cache_file(dir, key, len);
+	t (file == NULL);
+	fd = open(file, O_RDONLY);
+	t (fd == -1);
+	t (fstat(fd, &st));
+	size = (size_t)(st.st_size);
+	t (size < sizeof(head));
+	data = malloc(size);
+	t (data == NULL);
+	n = read(fd, data, size);
+	t ((n < 0) || ((size_t)n != size));
+	close(fd), fd = -1;
+
+	/* Check that the entry is well-formed and for the query. */
+	memcpy(&head, data, sizeof(head));
+	t (memcmp(head.magic, CACHE_MAGIC, sizeof(head.magic)));
+	t (head.stamps > (size - sizeof(head)) / sizeof(*stamps));
+	i = sizeof(head) + (size_t)(head.stamps) * sizeof(*stamps);
+	t ((head.key_size != len) || (len > size - i) || (head.paths_size > size - i - len));
+	t ((head.out_size > size) || (head.err_size > size));
+	t (i + len + head.paths_size + head.out_size + head.err_size != size);
+	t (memcmp(data + i, key, len));
+	p = data + i + len;
+	end = p + head.paths_size;
+	t (head.paths_size && end[-1]);
+
+	/* Check that nothing the query depends on has been modified. */
+	stamps = (struct cache_stamp *)(data + sizeof(head));
+	paths = malloc(((size_t)(head.stamps) + 1) * sizeof(*paths));
+	t (paths == NULL);
+	for (i = 0; i < head.stamps; i++, p = strchr(p, '\0') + 1) {
+		t (p == end);
+		get_stamp(p, &stamp);
+		t (memcmp(&stamp, stamps + i, sizeof(stamp)));
+		paths[i] = p;
+	}
+	t (p != end);
+	if (dep != NULL)
+		t (write_depfile(dep, paths, (size_t)(head.stamps)));
+
+	t (write_all(STDOUT_FILENO, end, (size_t)(head.out_size)));
+	t (write_all(STDERR_FILENO, end + head.out_size, (size_t)(head.err_size)));
+	*status = (int)(head.status);
+
+	free(paths);
+	free(key);
+	free(file);
+	free(data);
+	return 0;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	free(paths);
+	free(key);
+	free(file);
+	free(data);
+	return -1;
+}
+
+
+/**
+ * Store the result of a query in the result cache.
+ * 
+ * Failure is ignored, as it is only a cache.
+ * 
+ * @param  ctx      The context the query was run in.
+ * @param  dir      The cache directory.
+ * @param  key      The key of the query.
+ * @param  len      The size of `key`.
+ * @param  start    When the query began, in whole seconds. The result
+ *                  is not stored if a directory or file it depends on
+ *                  may have been modified since the query began.
+ * @param  status   The exit status of the query.
+ * @param  out      The output of the query.
+ * @param  out_len  The size of `out`.
+ * @param  err      The error output of the query.
+ * @param  err_len  The size of `err`.
+ */
+static void cache_store(const struct librarian *ctx, const char *dir, const char *key, size_t len,
+                        time_t start, int status, const char *out, size_t out_len,
+                        const char *err, size_t err_len)
+{
+	struct cache_header head;
+	struct cache_stamp *stamps = NULL;
+	const char *path;
+	char *file = NULL;
+	char *temp = NULL;
+	int fd = -1, created = 0, r;
+	size_t i;
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, CACHE_MAGIC, sizeof(head.magic));
+	head.status = status;
+	head.key_size = len;
+	head.out_size = out_len;
+	head.err_size = err_len;
+	while (librarian_consulted(ctx, (size_t)(head.stamps)))
+		head.stamps++;
+	stamps = malloc(((size_t)(head.stamps) + 1) * sizeof(*stamps));
+	t (stamps == NULL);
+	for (i = 0; (path = librarian_consulted(ctx, i)); i++) {
+		get_stamp(path, stamps + i);
+		t (stamps[i].ctime[0] >= (int64_t)start);
+		t (stamps[i].mtime[0] >= (int64_t)start);
+		head.paths_size += strlen(path) + 1;
+	}
+
+	if (mkdir(dir, 0755) && (errno != EEXIST))
+		goto fail;
+	file = cache_file(dir, key, len);
+	t (file == NULL);
+	temp = malloc(strlen(file) + sizeof(".XXXXXX"));
+	t (temp == NULL);
+	stpcpy(stpcpy(temp, file), ".XXXXXX");
+	fd = mkstemp(temp);
+	t (fd == -1);
+	created = 1;
+
+	t (write_all(fd, (const char *)&head, sizeof(head)));
+	t (write_all(fd, (const char *)stamps, (size_t)(head.stamps) * sizeof(*stamps)));
+	t (write_all(fd, key, len));
+	for (i = 0; (path = librarian_consulted(ctx, i)); i++)
+		t (write_all(fd, path, strlen(path) + 1));
+	t (write_all(fd, out, out_len));
+	t (write_all(fd, err, err_len));
+	r = close(fd), fd = -1;
+	t (r || rename(temp, file));
+
+	free(stamps);
+	free(file);
+	free(temp);
+	return;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	if (created)
+		unlink(temp);
+	free(stamps);
+	free(file);
+	free(temp);
+}
+
+
+/**
+ * Run a query, and store its result in the result cache.
+ * 
+ * @param   ctx   The context.
+ * @param   dir   The cache directory.
+ * @param   argc  The number of elements in `argv`.
+ * @param   argv  The command line, including the process name.
+ *                The content of `argv` is modified.
+ * @param   path  LIBRARIAN_PATH.
+ * @return        The exit status of the query, see run_query().
+ */
+int cache_query(struct librarian *ctx, const char *dir, int argc, char *argv[], const char *path)
+{
+	char *key;
+	char *out = NULL;
+	char *err = NULL;
+	size_t len, out_len = 0, err_len = 0;
+	FILE *out_stream = NULL;
+	FILE *err_stream = NULL;
+	time_t start;
+	int status, r;
+
+	key = make_key(argc, argv, path, &len);
+	if (key == NULL)
+		return run_query(ctx, argc, argv, path, stdout, stderr);
+
+	start = time(NULL);
+	out_stream = open_memstream(&out, &out_len);
+	t (out_stream == NULL);
+	err_stream = open_memstream(&err, &err_len);
+	t (err_stream == NULL);
+	status = run_query(ctx, argc, argv, path, out_stream, err_stream);
+	r = fclose(out_stream);
+	r |= fclose(err_stream);
+	out_stream = err_stream = NULL;
+	t (r);
+
+	/* Only results that depend on nothing but the files are stored. */
+	if ((status == 0) || (status == 2))
+		cache_store(ctx, dir, key, len, start, status, out, out_len, err, err_len);
+
+	t (write_all(STDOUT_FILENO, out, out_len));
+	t (write_all(STDERR_FILENO, err, err_len));
+
+	free(key);
+	free(out);
+	free(err);
+	return status;
+
+fail:
+	fprintf(stderr, "%s: %s\n", argc ? *argv : "librarian", strerror(errno));
+	if (out_stream != NULL)
+		fclose(out_stream);
+	if (err_stream != NULL)
+		fclose(err_stream);
+	free(key);
+	free(out);
+	free(err);
+	return 1;
+}
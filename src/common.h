@@ -0,0 +1,138 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "librarian.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdint.h>
+
+
+/**
+ * Default value for the environment variable LIBRARIAN_PATH.
+ */
+#ifndef DEFAULT_PATH
+# define DEFAULT_PATH  "/usr/local/share/librarian:/usr/share/librarian"
+#endif
+
+
+
+/**
+ * Marks functions that are shared between the
+ * translation units of liblibrarian, but are
+ * not a part of its API.
+ */
+#define LIBRARIAN_INTERNAL  __attribute__((visibility("hidden")))
+
+
+
+/**
+ * An io_uring instance used by librarian__open_files().
+ */
+struct file_ring;
+
+
+/**
+ * A file to open with librarian__open_files().
+ */
+struct file_open {
+	/**
+	 * The pathname of the file.
+	 */
+	const char *path;
+
+	/**
+	 * Output parameter for the file descriptor
+	 * of the file, -1 if the file could not be
+	 * opened or is not a regular file.
+	 */
+	int fd;
+
+	/**
+	 * Output parameter for the size of the file,
+	 * only set if `fd` is not -1.
+	 */
+	size_t size;
+};
+
+
+/**
+ * A depfile to write for a query.
+ */
+struct depfile {
+	/**
+	 * The pathname of the depfile.
+	 */
+	const char *file;
+
+	/**
+	 * The target whose prerequisites are listed.
+	 */
+	const char *target;
+
+	/**
+	 * Shall the depfile be written for Ninja,
+	 * rather than to be included by Make?
+	 */
+	int ninja;
+};
+
+
+
+/* liblibrarian.c, hooks for librarian.c and daemon.c */
+LIBRARIAN_INTERNAL void librarian_keep_indices(struct librarian *ctx, int keep);
+LIBRARIAN_INTERNAL void librarian_copy_files(struct librarian *ctx, int copy);
+LIBRARIAN_INTERNAL void librarian_set_watch(struct librarian *ctx, int (*watch)(void *data, const char *path),
+                                            void *data);
+LIBRARIAN_INTERNAL void librarian_invalidate(struct librarian *ctx, const char *path);
+LIBRARIAN_INTERNAL void librarian_release_caches(struct librarian *ctx);
+LIBRARIAN_INTERNAL void librarian_trace_begin(struct librarian *ctx, int argc, char *const argv[]);
+LIBRARIAN_INTERNAL void librarian_trace_end(struct librarian *ctx, int status);
+
+/* librarian.c */
+int run_query(struct librarian *ctx, int argc, char *argv[], const char *path, FILE *out, FILE *err);
+
+/* cache.c */
+int cache_lookup(const char *dir, int argc, char *argv[], const char *path, const struct depfile *dep,
+                 int *status);
+int cache_query(struct librarian *ctx, const char *dir, int argc, char *argv[], const char *path);
+
+/* depfile.c */
+int write_depfile(const struct depfile *dep, const char *const *paths, size_t n);
+int write_query_depfile(const struct depfile *dep, const struct librarian *ctx);
+
+/* daemon.c */
+int serve(struct librarian *ctx, const char *argv0);
+int query_daemon(int argc, char *argv[], const char *path, int *status);
+
+/* uring.c */
+LIBRARIAN_INTERNAL int librarian__open_files(struct file_ring **ring, struct file_open *files, size_t n);
+LIBRARIAN_INTERNAL void librarian__close_ring(struct file_ring *ring);
+
+#ifdef EMBED
+/* embedded.c, generated by embed.c */
+extern const char embedded_dir[];
+extern const uint64_t embedded_db[];
+extern const size_t embedded_db_size;
+extern const uint64_t embedded_db_hash;
+#endif
+
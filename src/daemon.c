@@ -0,0 +1,805 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+
+
+/**
+ * Events that invalidate what is known about a directory.
+ */
+#define WATCH_EVENTS  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |\
+                       IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+/**
+ * The number of seconds a client may take to send
+ * its query and receive the answer, and that a
+ * client waits for the daemon before it answers
+ * the query itself.
+ */
+#define CLIENT_TIMEOUT  5
+
+
+
+/**
+ * A watched directory.
+ */
+struct watch {
+	/**
+	 * The watch descriptor. Directories that
+	 * are the same directory share descriptor.
+	 */
+	int wd;
+
+	/**
+	 * The pathname of the directory, as
+	 * it appeared in LIBRARIAN_PATH.
+	 */
+	char *path;
+};
+
+
+
+/**
+ * A connected client.
+ */
+struct client {
+	/**
+	 * The client's socket.
+	 */
+	int fd;
+
+	/**
+	 * Has the query been answered, so that
+	 * `buf` holds the answer to send?
+	 */
+	int answered;
+
+	/**
+	 * The query received so far,
+	 * or the answer to send.
+	 */
+	char *buf;
+
+	/**
+	 * The number of bytes in `buf`.
+	 */
+	size_t len;
+
+	/**
+	 * The allocation size of `buf`.
+	 */
+	size_t size;
+
+	/**
+	 * The number of bytes of the answer that have been sent.
+	 */
+	size_t sent;
+
+	/**
+	 * When the client is dropped, in milliseconds
+	 * on the monotonic clock.
+	 */
+	long long int deadline;
+};
+
+
+
+/**
+ * The inotify instance.
+ */
+static int inotify_fd = -1;
+
+/**
+ * Watched directories.
+ */
+static struct watch *watches = NULL;
+
+/**
+ * The number of elements in `watches`.
+ */
+static size_t watches_count = 0;
+
+/**
+ * Connected clients.
+ */
+static struct client *clients = NULL;
+
+/**
+ * The number of elements in `clients`.
+ */
+static size_t clients_count = 0;
+
+/**
+ * The allocation size of `clients`.
+ */
+static size_t clients_size = 0;
+
+/**
+ * Has the daemon been told to exit?
+ */
+static volatile sig_atomic_t terminated = 0;
+
+
+
+/**
+ * Get the pathname of the daemon's socket.
+ * 
+ * @return  The pathname of the socket, `NULL` on error or if
+ *          there is none, in which case `errno` is set to 0.
+ */
+static char *get_socket_path(void)
+{
+	const char *s = getenv("LIBRARIAN_SOCKET");
+	char *rc;
+
+	if (s && *s)
+		return strdup(s);
+
+	s = getenv("XDG_RUNTIME_DIR");
+	if (!s || !*s)
+		return errno = 0, NULL;
+	rc = malloc(strlen(s) + sizeof("/librarian.socket"));
+	if (rc != NULL)
+		stpcpy(stpcpy(rc, s), "/librarian.socket");
+	return rc;
+}
+
+
+/**
+ * Create a socket address for a pathname.
+ * 
+ * @param   addr  Output parameter for the address.
+ * @param   path  The pathname of the socket.
+ * @return        0 on success, -1 on error.
+ */
+static int make_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return errno = ENAMETOOLONG, -1;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+
+/**
+ * Get the current time on the monotonic clock.
+ * 
+ * @return  The time, in milliseconds.
+ */
+static long long int now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long int)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Wait until a non-blocking socket is ready.
+ * 
+ * @param   fd        The socket.
+ * @param   events    `POLLIN` or `POLLOUT`.
+ * @param   deadline  When to give up, see now_ms().
+ * @return            0 when ready, -1 on error, `errno` is
+ *                    set to `ETIMEDOUT` if the deadline passed.
+ */
+static int wait_for(int fd, short events, long long int deadline)
+{
+	struct pollfd pfd;
+	long long int left;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	for (;;) {
+		left = deadline - now_ms();
+		if (left <= 0)
+			return errno = ETIMEDOUT, -1;
+		r = poll(&pfd, 1, (int)left);
+		if (r > 0)
+			return 0;
+		if (r < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+
+/**
+ * Write an entire buffer to a non-blocking socket.
+ * 
+ * @param   fd        The socket.
+ * @param   buf       The buffer.
+ * @param   n         The size of `buf`.
+ * @param   deadline  When to give up, see now_ms().
+ * @return            0 on success, -1 on error or timeout.
+ */
+static int send_all(int fd, const char *buf, size_t n, long long int deadline)
+{
+	ssize_t r;
+	while (n) {
+		r = send(fd, buf, n, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_for(fd, POLLOUT, deadline))
+				return -1;
+			continue;
+		}
+		buf += (size_t)r;
+		n -= (size_t)r;
+	}
+	return 0;
+}
+
+
+/**
+ * Read from a non-blocking socket until
+ * the other end stops writing.
+ * 
+ * @param   fd        The socket.
+ * @param   n         Output parameter for the number of read bytes.
+ * @param   deadline  When to give up, see now_ms().
+ * @return            The read data, `NULL` on error or timeout.
+ */
+static char *recv_all(int fd, size_t *n, long long int deadline)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	ssize_t r;
+
+	for (*n = 0;;) {
+		MAYBE_GROW(buf, *n, size, 512);
+		r = read(fd, buf + *n, size - *n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			t ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_for(fd, POLLIN, deadline));
+			continue;
+		}
+		if (r == 0)
+			return buf;
+		*n += (size_t)r;
+	}
+
+fail:
+	free(buf);
+	return NULL;
+}
+
+
+/**
+ * Let the daemon answer a query, and print its answer.
+ * 
+ * The daemon is not used if LIBRARIAN_PATH contains
+ * relative pathnames, as the daemon does not know
+ * the working directory of the process. If the daemon
+ * has not answered within `CLIENT_TIMEOUT` seconds,
+ * for example because it is busy or wedged, the
+ * process answers the query itself.
+ * 
+ * @param   argc    The number of elements in `argv`.
+ * @param   argv    The command line, including the process name.
+ * @param   path    LIBRARIAN_PATH.
+ * @param   status  Output parameter for the exit status of the query.
+ * @return          0 if the daemon answered, -1 if the query
+ *                  must be answered by the process itself.
+ */
+int query_daemon(int argc, char *argv[], const char *path, int *status)
+{
+	struct sockaddr_un addr;
+	char *sock = NULL;
+	char *buf = NULL;
+	char *p;
+	char *end;
+	size_t size = 0, len, n, out_len;
+	int fd = -1, i;
+	long int value;
+	long long int deadline = now_ms() + CLIENT_TIMEOUT * 1000;
+
+	if (argc < 1)
+		return -1;
+	for (p = (char *)path; p; p = strchr(p, ':')) {
+		p += (*p == ':');
+		if (*p && (*p != ':') && (*p != '/'))
+			return -1;
+	}
+
+	sock = get_socket_path();
+	t (sock == NULL);
+	t (make_address(&addr, sock));
+	free(sock), sock = NULL;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	t (fd < 0);
+	/* Non-blocking, so that a daemon with a full backlog is not waited for either. */
+	t (fcntl(fd, F_SETFL, O_NONBLOCK));
+	t (connect(fd, (struct sockaddr *)&addr, (socklen_t)sizeof(addr)));
+
+	/* Send the query. */
+	for (i = 0; i <= argc; i++)
+		size += strlen(i < argc ? argv[i] : path) + 1;
+	size += 3 * sizeof(int) + 1;
+	buf = malloc(size);
+	t (buf == NULL);
+	p = buf + sprintf(buf, "%i", argc) + 1;
+	for (i = 0; i <= argc; i++)
+		p = stpcpy(p, i < argc ? argv[i] : path) + 1;
+	t (send_all(fd, buf, (size_t)(p - buf), deadline));
+	t (shutdown(fd, SHUT_WR));
+	free(buf);
+
+	/* Receive the answer, which is the exit status, the size
+	 * of the output, the output, and the error messages. */
+	buf = recv_all(fd, &n, deadline);
+	t (buf == NULL);
+	close(fd), fd = -1;
+	t (!n || !memchr(buf, '\0', n));
+	len = strlen(buf) + 1;
+	value = strtol(buf, &end, 10);
+	t (*end || (value < 0) || (value > 255));
+	*status = (int)value;
+	t (!memchr(buf + len, '\0', n - len));
+	out_len = (size_t)strtoul(buf + len, &end, 10);
+	t (*end);
+	len += strlen(buf + len) + 1;
+	t (out_len > n - len);
+
+	fwrite(buf + len, 1, out_len, stdout);
+	len += out_len;
+	if (fflush(stdout) || ferror(stdout)) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		*status = 1;
+	} else {
+		fwrite(buf + len, 1, n - len, stderr);
+	}
+
+	free(buf);
+	return 0;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	free(sock);
+	free(buf);
+	return -1;
+}
+
+
+/**
+ * Start watching a directory.
+ * 
+ * @param   data  Unused.
+ * @param   path  The pathname of the directory.
+ * @return        0 on success, -1 on error.
+ */
+static int add_watch(void *data, const char *path)
+{
+	size_t i;
+	int wd;
+
+	(void) data;
+	for (i = 0; i < watches_count; i++)
+		if (!strcmp(watches[i].path, path))
+			return 0;
+
+	REALLOC(watches, watches_count + 1);
+	watches[watches_count].path = strdup(path);
+	t (watches[watches_count].path == NULL);
+	wd = inotify_add_watch(inotify_fd, path, WATCH_EVENTS);
+	if (wd < 0) {
+		free(watches[watches_count].path);
+		goto fail;
+	}
+	watches[watches_count++].wd = wd;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Invalidate everything known about directories
+ * that have been modified.
+ * 
+ * @param   ctx  The context.
+ * @return       0 on success, -1 on error.
+ */
+static int process_events(struct librarian *ctx)
+{
+	union {
+		struct inotify_event event;
+		char buf[sizeof(struct inotify_event) + 256 + 1];
+	} u;
+	char *buf = u.buf;
+	struct inotify_event *event;
+	size_t off, i;
+	ssize_t n;
+
+	for (;;) {
+		n = read(inotify_fd, buf, sizeof(u));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN) ? 0 : -1;
+		}
+		for (off = 0; off < (size_t)n; off += sizeof(*event) + event->len) {
+			event = (struct inotify_event *)(buf + off);
+			if (event->mask & IN_Q_OVERFLOW) {
+				librarian_release_caches(ctx);
+				continue;
+			}
+			for (i = 0; i < watches_count; i++) {
+				if (watches[i].wd != event->wd)
+					continue;
+				librarian_invalidate(ctx, watches[i].path);
+				if (event->mask & IN_IGNORED) {
+					free(watches[i].path);
+					watches[i--] = watches[--watches_count];
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * Accept all pending connections.
+ * 
+ * @param   fd  The listening socket.
+ * @return      0 on success, -1 on error.
+ */
+static int accept_clients(int fd)
+{
+	int cfd;
+
+	for (;;) {
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		if (fcntl(cfd, F_SETFL, O_NONBLOCK) || fcntl(cfd, F_SETFD, FD_CLOEXEC)) {
+			close(cfd);
+			continue;
+		}
+		MAYBE_GROW(clients, clients_count, clients_size, 16);
+		memset(clients + clients_count, 0, sizeof(*clients));
+		clients[clients_count].fd = cfd;
+		clients[clients_count++].deadline = now_ms() + CLIENT_TIMEOUT * 1000;
+	}
+
+fail:
+	close(cfd);
+	return -1;
+}
+
+
+/**
+ * Disconnect a client.
+ * 
+ * @param  i  The index of the client in `clients`.
+ */
+static void drop_client(size_t i)
+{
+	close(clients[i].fd);
+	free(clients[i].buf);
+	clients[i] = clients[--clients_count];
+}
+
+
+/**
+ * Read what a client has sent, without blocking.
+ * 
+ * @param   c  The client.
+ * @return     1: The whole query has been received.
+ *             0: The query is incomplete.
+ *             -1: An error occurred.
+ */
+static int receive_query(struct client *c)
+{
+	ssize_t r;
+
+	for (;;) {
+		MAYBE_GROW(c->buf, c->len, c->size, 512);
+		r = read(c->fd, c->buf + c->len, c->size - c->len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		if (r == 0)
+			return 1;
+		c->len += (size_t)r;
+	}
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Answer the query a client has sent, replacing
+ * the query in the client's buffer with the answer.
+ * 
+ * @param   ctx  The context.
+ * @param   c    The client.
+ * @return       0 on success, -1 on error.
+ */
+static int answer_query(struct librarian *ctx, struct client *c)
+{
+	char **argv = NULL;
+	char *buf = c->buf;
+	char *out = NULL;
+	char *err = NULL;
+	size_t out_len = 0, err_len = 0;
+	FILE *out_stream = NULL;
+	FILE *err_stream = NULL;
+	char *answer;
+	char *p;
+	char *end;
+	size_t n = c->len, len;
+	long int argc, i;
+	int status, r;
+
+	/* Parse query. */
+	t (!n || buf[n - 1]);
+	argc = strtol(buf, &end, 10);
+	t (*end || (argc < 1) || ((size_t)argc > n));
+	argv = calloc((size_t)argc + 1, sizeof(*argv));
+	t (argv == NULL);
+	p = buf + strlen(buf) + 1;
+	for (i = 0; i < argc; i++) {
+		t (p == buf + n);
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	t (p == buf + n);
+
+	/* Run query. */
+	out_stream = open_memstream(&out, &out_len);
+	t (out_stream == NULL);
+	err_stream = open_memstream(&err, &err_len);
+	t (err_stream == NULL);
+	status = run_query(ctx, (int)argc, argv, p, out_stream, err_stream);
+	r = fclose(out_stream);
+	out_stream = NULL;
+	t (r);
+	r = fclose(err_stream);
+	err_stream = NULL;
+	t (r);
+
+	/* Prepare answer, which is the exit status, the size
+	 * of the output, the output, and the error messages. */
+	answer = malloc(3 * sizeof(int) + 3 * sizeof(size_t) + 3 + out_len + err_len);
+	t (answer == NULL);
+	len = (size_t)sprintf(answer, "%i", status) + 1;
+	len += (size_t)sprintf(answer + len, "%zu", out_len) + 1;
+	memcpy(answer + len, out, out_len);
+	memcpy(answer + len + out_len, err, err_len);
+	free(c->buf);
+	c->buf = answer;
+	c->len = c->size = len + out_len + err_len;
+	c->answered = 1;
+
+	free(argv);
+	free(out);
+	free(err);
+	return 0;
+
+fail:
+	if (out_stream != NULL)
+		fclose(out_stream);
+	if (err_stream != NULL)
+		fclose(err_stream);
+	free(argv);
+	free(out);
+	free(err);
+	return -1;
+}
+
+
+/**
+ * Send as much of the answer to a client's
+ * query as possible, without blocking.
+ * 
+ * @param   c  The client.
+ * @return     1: The whole answer has been sent.
+ *             0: The answer is incomplete.
+ *             -1: An error occurred.
+ */
+static int send_answer(struct client *c)
+{
+	ssize_t r;
+
+	while (c->sent < c->len) {
+		r = send(c->fd, c->buf + c->sent, c->len - c->sent, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->sent += (size_t)r;
+	}
+	return 1;
+}
+
+
+/**
+ * Signal handler for signals that terminate the daemon.
+ * 
+ * @param  signo  The received signal.
+ */
+static void terminate(int signo)
+{
+	terminated = 1;
+	(void) signo;
+}
+
+
+/**
+ * Run the daemon until it is terminated.
+ * 
+ * @param   ctx    The context.
+ * @param   argv0  The name of the process.
+ * @return         0: The daemon exited normally.
+ *                 1: An error occurred.
+ */
+int serve(struct librarian *ctx, const char *argv0)
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct pollfd *fds = NULL;
+	struct client *c;
+	char *sock = NULL;
+	int fd = -1, bound = 0, rc = 0, r, timeout;
+	mode_t old_umask;
+	long long int now, wait;
+	size_t i;
+
+	sock = get_socket_path();
+	if (sock == NULL) {
+		if (errno)
+			goto fail;
+		fprintf(stderr, "%s: neither LIBRARIAN_SOCKET nor XDG_RUNTIME_DIR is set\n", argv0);
+		return 1;
+	}
+	t (make_address(&addr, sock));
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	t (fd < 0);
+	if (!connect(fd, (struct sockaddr *)&addr, (socklen_t)sizeof(addr))) {
+		fprintf(stderr, "%s: the daemon is already running\n", argv0);
+		close(fd);
+		free(sock);
+		return 1;
+	}
+	t (unlink(sock) && (errno != ENOENT));
+	old_umask = umask(0077);
+	if (bind(fd, (struct sockaddr *)&addr, (socklen_t)sizeof(addr))) {
+		umask(old_umask);
+		goto fail;
+	}
+	umask(old_umask);
+	bound = 1;
+	t (listen(fd, SOMAXCONN));
+	t (fcntl(fd, F_SETFL, O_NONBLOCK));
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	t (inotify_fd < 0);
+	librarian_set_watch(ctx, add_watch, NULL);
+	librarian_keep_indices(ctx, 1);
+	librarian_copy_files(ctx, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = terminate;
+	sigemptyset(&sa.sa_mask);
+	t (sigaction(SIGINT, &sa, NULL) || sigaction(SIGTERM, &sa, NULL) || sigaction(SIGHUP, &sa, NULL));
+	sa.sa_handler = SIG_IGN;
+	t (sigaction(SIGPIPE, &sa, NULL));
+
+	/* Clients are served without blocking, so that
+	 * a stalled client cannot hold up the others. */
+	while (!terminated) {
+		REALLOC(fds, clients_count + 2);
+		fds[0].fd = fd;
+		fds[1].fd = inotify_fd;
+		fds[0].events = fds[1].events = POLLIN;
+		timeout = -1;
+		now = now_ms();
+		for (i = 0; i < clients_count; i++) {
+			fds[i + 2].fd = clients[i].fd;
+			fds[i + 2].events = clients[i].answered ? POLLOUT : POLLIN;
+			wait = clients[i].deadline > now ? clients[i].deadline - now : 0;
+			if ((timeout < 0) || (wait < timeout))
+				timeout = (int)wait;
+		}
+		if (poll(fds, (nfds_t)(clients_count + 2), timeout) < 0) {
+			t (errno != EINTR);
+			continue;
+		}
+		t (process_events(ctx));
+
+		/* Clients are dropped by moving the last client into
+		 * their place, so they are visited from the last. */
+		now = now_ms();
+		for (i = clients_count; i--;) {
+			c = clients + i;
+			if (fds[i + 2].revents) {
+				r = c->answered ? send_answer(c) : receive_query(c);
+				if ((r > 0) && !c->answered) {
+					/* Changes made just before the query was sent must be seen. */
+					t (process_events(ctx));
+					r = answer_query(ctx, c) ? -1 : send_answer(c);
+				}
+				if (r) {
+					drop_client(i);
+					continue;
+				}
+			}
+			if (c->deadline <= now)
+				drop_client(i);
+		}
+
+		if (fds[0].revents & POLLIN)
+			t (accept_clients(fd));
+	}
+
+done:
+	while (clients_count)
+		drop_client(clients_count - 1);
+	free(clients);
+	free(fds);
+	if (fd >= 0)
+		close(fd);
+	if (bound)
+		unlink(sock);
+	if (inotify_fd >= 0)
+		close(inotify_fd);
+	while (watches_count--)
+		free(watches[watches_count].path);
+	free(watches);
+	free(sock);
+	return rc;
+
+fail:
+	fprintf(stderr, "%s: %s\n", argv0, strerror(errno));
+	rc = 1;
+	goto done;
+}
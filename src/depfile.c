@@ -0,0 +1,141 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * Write a pathname to a depfile, escaped.
+ * 
+ * In Make, `=` cannot be escaped in a rule, so it is
+ * written as a reference to a variable that the depfile
+ * defines. Ninja reads `=` literally, but not variables.
+ * 
+ * @param   f      The depfile.
+ * @param   s      The pathname.
+ * @param   ninja  Is the depfile for Ninja?
+ * @return         0 on success, -1 on error.
+ */
+static int write_name(FILE *f, const char *s, int ninja)
+{
+	for (; *s; s++) {
+		if (*s == '$')
+			t (fputs("$$", f) == EOF);
+		else if (!ninja && (*s == '='))
+			t (fputs("$(LIBRARIAN_EQUALS)", f) == EOF);
+		else if ((*s == ' ') || (*s == '\t') || (*s == '#') || (!ninja && (*s == ':')))
+			t (fprintf(f, "\\%c", *s) < 0);
+		else
+			t (fputc(*s, f) == EOF);
+	}
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Write a depfile that lists the directories and files
+ * the result of a query depends on. Directories and
+ * files that do not exist are left out.
+ * 
+ * For Make, each prerequisite also gets a rule without
+ * a recipe, so that removing it reruns the query rather
+ * than failing the build.
+ * 
+ * @param   dep    The depfile.
+ * @param   paths  The pathnames of the directories and files.
+ * @param   n      The number of elements in `paths`.
+ * @return         0 on success, -1 on error.
+ */
+int write_depfile(const struct depfile *dep, const char *const *paths, size_t n)
+{
+	FILE *f = NULL;
+	struct stat st;
+	char *exists = NULL;
+	size_t i;
+	int r;
+
+	exists = malloc(n + !n);
+	t (exists == NULL);
+	for (i = 0; i < n; i++)
+		exists[i] = !stat(paths[i], &st);
+
+	f = fopen(dep->file, "w");
+	t (f == NULL);
+	if (!dep->ninja)
+		t (fputs("LIBRARIAN_EQUALS = =\n", f) == EOF);
+	t (write_name(f, dep->target, dep->ninja) || (fputc(':', f) == EOF));
+	for (i = 0; i < n; i++)
+		if (exists[i])
+			t ((fputs(" \\\n ", f) == EOF) || write_name(f, paths[i], dep->ninja));
+	t (fputc('\n', f) == EOF);
+	for (i = 0; !dep->ninja && (i < n); i++)
+		if (exists[i])
+			t ((fputc('\n', f) == EOF) || write_name(f, paths[i], 0) || (fputs(":\n", f) == EOF));
+	r = fclose(f), f = NULL;
+	t (r);
+
+	free(exists);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (f != NULL)
+		fclose(f);
+	free(exists);
+	}
+}
+
+
+/**
+ * Write a depfile for the last query run in a context.
+ * 
+ * @param   dep  The depfile.
+ * @param   ctx  The context.
+ * @return       0 on success, -1 on error.
+ */
+int write_query_depfile(const struct depfile *dep, const struct librarian *ctx)
+{
+	const char **paths = NULL;
+	size_t n = 0;
+	int r;
+
+	while (librarian_consulted(ctx, n))
+		n++;
+	paths = malloc((n + 1) * sizeof(*paths));
+	if (paths == NULL)
+		return -1;
+	for (n = 0; (paths[n] = librarian_consulted(ctx, n)); n++);
+	r = write_depfile(dep, paths, n);
+	free(paths);
+	return r;
+}
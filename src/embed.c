@@ -0,0 +1,121 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+#include "common.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+
+
+
+/**
+ * Print a string as a C string literal.
+ * 
+ * @param   s  The string.
+ * @return     0 on success, -1 on error.
+ */
+static int print_c_string(const char *s)
+{
+	t (putchar('"') == EOF);
+	for (; *s; s++) {
+		if ((*s == '"') || (*s == '\\'))
+			t (printf("\\%c", *s) < 0);
+		else if ((unsigned char)*s < ' ' || (unsigned char)*s >= 127)
+			t (printf("\\%03o", (unsigned)(unsigned char)*s) < 0);
+		else
+			t (putchar(*s) == EOF);
+	}
+	t (putchar('"') == EOF);
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Compile a directory of librarian files into a database,
+ * and print C source that embeds the database, for
+ * `make EMBED_DIR=...`. The database is stored as
+ * `uint64_t`:s, in the byte order of the machine
+ * the program runs on, and its FNV-1a hash is
+ * stored so that cached queries can tell which
+ * database they were answered from.
+ * 
+ * @return  0: Program was successful.
+ *          1: An error occurred.
+ *          3: Usage error.
+ */
+int main(int argc, char *argv[])
+{
+	struct librarian *ctx = NULL;
+	unsigned char buf[sizeof(uint64_t)];
+	uint64_t word, hash = UINT64_C(0xCBF29CE484222325);
+	size_t n, i, size = 0;
+	FILE *f = NULL;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s DIRECTORY DATABASE\n", argc ? *argv : "librarian-embed");
+		return 3;
+	}
+
+	ctx = librarian_create();
+	t (ctx == NULL);
+	t (librarian_set_path(ctx, argv[1]));
+	t (librarian_compile(ctx, argv[2]));
+
+	f = fopen(argv[2], "rb");
+	t (f == NULL);
+	t (printf("/* Generated from %s by %s, do not edit. */\n", argv[1], *argv) < 0);
+	t (printf("#include <stddef.h>\n#include <stdint.h>\n\n") < 0);
+	t (printf("const char embedded_dir[] = ") < 0);
+	t (print_c_string(argv[1]));
+	t (printf(";\n\nconst uint64_t embedded_db[] = {") < 0);
+	while ((n = fread(buf, 1, sizeof(buf), f))) {
+		for (i = 0; i < n; i++)
+			hash = (hash ^ buf[i]) * UINT64_C(0x100000001B3);
+		memset(buf + n, 0, sizeof(buf) - n);
+		memcpy(&word, buf, sizeof(word));
+		t (printf("%sUINT64_C(0x%016llx),", size % (4 * sizeof(buf)) ? " " : "\n\t",
+		          (unsigned long long int)word) < 0);
+		size += n;
+	}
+	t (ferror(f));
+	t (printf("\n};\n\nconst size_t embedded_db_size = %zu;\n", size) < 0);
+	t (printf("const uint64_t embedded_db_hash = UINT64_C(0x%016llx);\n", (unsigned long long int)hash) < 0);
+	t (fflush(stdout));
+
+	fclose(f);
+	librarian_destroy(ctx);
+	return 0;
+
+fail:
+	fprintf(stderr, "%s: %s\n", argc ? *argv : "librarian-embed", strerror(errno));
+	if (f != NULL)
+		fclose(f);
+	librarian_destroy(ctx);
+	return 1;
+}
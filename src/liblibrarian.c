@@ -0,0 +1,6285 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _POSIX_C_SOURCE  200809L
+/* Count the allocations of REALLOC(), GROW() and MAYBE_GROW(). */
+#define REALLOC_FUNCTION  counted_realloc
+#include "common.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+
+/**
+ * The number of runs a version key can
+ * hold without allocating memory.
+ */
+#define VERSION_KEY_RUNS  16
+
+
+/**
+ * A run of digits, or of non-digits, in a version number.
+ */
+struct version_run {
+	/**
+	 * The run, with leading zeroes removed if it is
+	 * a run of digits, not NUL-terminated; `NULL`
+	 * if this is the head of a segment.
+	 */
+	const char *str;
+
+	/**
+	 * The length of `str`, or if this is the head of a
+	 * segment, the number of runs in the segment.
+	 */
+	size_t len;
+};
+
+
+/**
+ * A version number, split into segments that can be
+ * compared without parsing the version number again.
+ * 
+ * The first segment is the epoch, and the rest are the
+ * dot-separated parts of the version number. Each segment
+ * is a head followed by alternating runs of digits and
+ * non-digits, starting with a, possibly empty, run of digits.
+ * The runs point into the version number, which must
+ * not be modified or released while the key is used.
+ */
+struct version_key {
+	/**
+	 * The runs, if they did not fit in `small`.
+	 */
+	struct version_run *heap;
+
+	/**
+	 * The number of runs, including heads.
+	 */
+	size_t count;
+
+	/**
+	 * The runs, unless `heap` is set.
+	 */
+	struct version_run small[VERSION_KEY_RUNS];
+};
+
+
+/**
+ * A library and version range.
+ */
+struct library {
+	/**
+	 * The name of the library.
+	 */
+	const char *name;
+
+  	/**
+	 * The lowest acceptable version.
+	 * `NULL` if unbounded.
+	 */
+	char *lower;
+
+  	/**
+	 * The highest acceptable version.
+	 * `NULL` if unbounded.
+	 */
+	char *upper;
+
+  	/**
+	 * Is the version stored in
+	 * `lower` acceptable.
+	 */
+	int lower_closed;
+
+  	/**
+	 * Is the version stored in
+	 * `ypper` acceptable.
+	 */
+	int upper_closed;
+
+	/**
+	 * `lower` as a version key, if set.
+	 */
+	struct version_key lower_key;
+
+	/**
+	 * `upper` as a version key, if set and not
+	 * the same string as `lower`, in which case
+	 * `lower_key` is used for both.
+	 */
+	struct version_key upper_key;
+
+	/**
+	 * Where the specification was found, 0 for the
+	 * command line, otherwise the index of the librarian
+	 * file that depends on the library, plus 1.
+	 * Specifications with the same name and origin are
+	 * alternatives, otherwise all must be satisfied.
+	 */
+	size_t origin;
+};
+
+
+/**
+ * Structure for already located librarian files.
+ */
+struct found_file {
+	/**
+	 * The name of the library.
+	 */
+	const char *name;
+
+	/**
+	 * The found version of the library.
+	 */
+	const char *version;
+
+	/**
+	 * The path name of the librarian file,
+	 * stored in the context's arena.
+	 */
+	const char *path;
+
+	/**
+	 * The content of the librarian file,
+	 * `NULL` if it has not been looked up yet.
+	 */
+	struct parsed_file *parsed;
+
+	/**
+	 * The index of the round of find_librarian_files()
+	 * that found the file, `SIZE_MAX` if the file was
+	 * chosen by resolve(), for LIBRARIAN_TRACE.
+	 */
+	size_t round;
+
+	/**
+	 * The number of microseconds spent loading
+	 * the file, for LIBRARIAN_TRACE.
+	 */
+	double load_time;
+
+	/**
+	 * The number of variables looked up in
+	 * the file, for LIBRARIAN_TRACE.
+	 */
+	size_t lookups;
+
+	/**
+	 * The number of microseconds spent looking up
+	 * variables in the file, for LIBRARIAN_TRACE.
+	 */
+	double lookup_time;
+};
+
+
+/**
+ * A variable in a librarian file.
+ */
+struct variable {
+	/**
+	 * The name of the variable,
+	 * `NULL` for unused slots.
+	 */
+	const char *name;
+
+	/**
+	 * The length of `name`.
+	 */
+	size_t name_len;
+
+	/**
+	 * The value of the variable.
+	 */
+	const char *value;
+
+	/**
+	 * The length of `value`.
+	 */
+	size_t value_len;
+};
+
+
+/**
+ * The content of a librarian file.
+ */
+struct parsed_file {
+	/**
+	 * The pathname of the file.
+	 */
+	char *path;
+
+	/**
+	 * The content of the file, not NUL-terminated.
+	 */
+	const char *data;
+
+	/**
+	 * The size of `data`.
+	 */
+	size_t size;
+
+	/**
+	 * Is `data` memory mapped, rather
+	 * than allocated with malloc(3)?
+	 */
+	int mapped;
+
+	/**
+	 * The offset of the first line in
+	 * `data` that has not been indexed.
+	 */
+	size_t scanned;
+
+	/**
+	 * Hash table of the variables indexed so
+	 * far, only the first occurrence of a
+	 * variable is included.
+	 */
+	struct variable *vars;
+
+	/**
+	 * The number of slots in `vars` less one.
+	 */
+	size_t mask;
+
+	/**
+	 * The number of used slots in `vars`.
+	 */
+	size_t count;
+
+	/**
+	 * The value of `ctx->query` when the file
+	 * was last added to `ctx->consulted`.
+	 */
+	unsigned long long consulted;
+};
+
+
+/**
+ * The header of an index file.
+ * 
+ * An index file is followed by `names` `struct index_name`:s,
+ * sorted by library name, and `entries` `uint64_t`:s, each
+ * being the offset of a filename in the file, where filenames
+ * of the same library are stored consecutively and sorted by
+ * version. The rest of the file are NUL-terminated strings.
+ */
+struct index_header {
+	/**
+	 * Shall be `INDEX_MAGIC`.
+	 */
+	char magic[8];
+
+	/**
+	 * The device the indexed directory is stored on.
+	 */
+	uint64_t dev;
+
+	/**
+	 * The inode number of the indexed directory.
+	 */
+	uint64_t ino;
+
+	/**
+	 * The indexed directory's last modification time,
+	 * seconds and nanoseconds.
+	 */
+	int64_t mtime[2];
+
+	/**
+	 * The indexed directory's last status change time,
+	 * seconds and nanoseconds.
+	 */
+	int64_t ctime[2];
+
+	/**
+	 * The number of library names.
+	 */
+	uint64_t names;
+
+	/**
+	 * The number of librarian files.
+	 */
+	uint64_t entries;
+
+	/**
+	 * The size of the file.
+	 */
+	uint64_t size;
+};
+
+
+/**
+ * A librarian file found when indexing a directory.
+ */
+struct dir_entry {
+	/**
+	 * The filename.
+	 */
+	char *name;
+
+	/**
+	 * The version of the library, as a version key.
+	 */
+	struct version_key key;
+};
+
+
+/**
+ * A library name in an index file.
+ */
+struct index_name {
+	/**
+	 * The offset of the name.
+	 */
+	uint64_t name;
+
+	/**
+	 * The index of the library's first entry.
+	 */
+	uint64_t first;
+
+	/**
+	 * The number of entries for the library.
+	 */
+	uint64_t count;
+};
+
+
+/**
+ * The header of a database file.
+ * 
+ * A database file is laid out as an index file, except that
+ * `index.dev`, `index.ino`, `index.mtime` and `index.ctime`
+ * are unused, and that the filename offsets are followed by
+ * `index.entries` `struct db_file`:s, one per filename, and
+ * `variables` `struct db_variable`:s before the strings. The
+ * file ends with a NUL byte.
+ */
+struct db_header {
+	/**
+	 * `index.magic` shall be `DB_MAGIC`.
+	 */
+	struct index_header index;
+
+	/**
+	 * The number of variables.
+	 */
+	uint64_t variables;
+
+	/**
+	 * The number of directories the database was
+	 * compiled from, counting the directories of
+	 * databases it was compiled from.
+	 */
+	uint64_t dirs;
+};
+
+
+/**
+ * The variables of a librarian file in a database.
+ */
+struct db_file {
+	/**
+	 * The index of the file's first variable.
+	 */
+	uint64_t first;
+
+	/**
+	 * The number of variables in the file.
+	 */
+	uint64_t count;
+
+	/**
+	 * The index of the directory, of those the database
+	 * was compiled from, the file was found in. Files with
+	 * the same version as a file in an earlier directory
+	 * are kept, as the dependency resolver may use them,
+	 * but have zeros prepended to their version, which
+	 * does not change it, to give them unique filenames.
+	 */
+	uint64_t dir;
+};
+
+
+/**
+ * A variable in a librarian file in a database, only the
+ * first occurrence of a variable in a file is included.
+ */
+struct db_variable {
+	/**
+	 * The offset of the name of the variable.
+	 */
+	uint64_t name;
+
+	/**
+	 * The length of the name of the variable.
+	 */
+	uint64_t name_len;
+
+	/**
+	 * The offset of the value of the variable.
+	 */
+	uint64_t value;
+
+	/**
+	 * The length of the value of the variable.
+	 */
+	uint64_t value_len;
+};
+
+
+/**
+ * A librarian file to list, or to store in a database.
+ */
+struct db_entry {
+	/**
+	 * The filename, points into the index
+	 * of the directory it was found in.
+	 */
+	const char *name;
+
+	/**
+	 * The version of the library, as a version key.
+	 */
+	struct version_key key;
+
+	/**
+	 * The index of the directory, in LIBRARIAN_PATH,
+	 * the file was found in.
+	 */
+	size_t dir;
+
+	/**
+	 * The order of the directory the file was found
+	 * in, counting the directories of databases.
+	 */
+	size_t rank;
+
+	/**
+	 * The number of zeros to prepend to the version
+	 * in a database, to give the file a unique name.
+	 */
+	size_t zeros;
+
+	/**
+	 * The content of the file.
+	 */
+	struct parsed_file *file;
+};
+
+
+/**
+ * A loaded index of a directory, or a database.
+ */
+struct dir_index {
+	/**
+	 * The pathname of the directory, as
+	 * it appeared in LIBRARIAN_PATH.
+	 */
+	char *path;
+
+	/**
+	 * The content of the index file.
+	 */
+	char *data;
+
+	/**
+	 * The size of `data`.
+	 */
+	size_t size;
+
+	/**
+	 * Is `data` memory mapped, rather
+	 * than allocated with malloc(3)?
+	 */
+	int mapped;
+
+	/**
+	 * Is `data` an embedded database, owned by the
+	 * caller of librarian_embed()? Such an index is
+	 * kept until the context is destroyed.
+	 */
+	int borrowed;
+
+	/**
+	 * The library names.
+	 */
+	struct index_name *names;
+
+	/**
+	 * The filename offsets.
+	 */
+	uint64_t *entries;
+
+	/**
+	 * For each filename, the version as a version key,
+	 * made when first needed, `NULL` until any is needed.
+	 * A key whose `count` is 0 has not been made.
+	 */
+	struct version_key *keys;
+
+	/**
+	 * For each filename, the librarian file's variables,
+	 * `NULL` unless this is a database.
+	 */
+	struct db_file *files;
+
+	/**
+	 * The variables in the database, `NULL`
+	 * unless this is a database.
+	 */
+	struct db_variable *variables;
+};
+
+
+/**
+ * A librarian file considered by the dependency resolver.
+ */
+struct candidate {
+	/**
+	 * The pathname of the file.
+	 */
+	char *path;
+
+	/**
+	 * The version of the library, points into `path`.
+	 */
+	char *version;
+
+	/**
+	 * `version` as a version key.
+	 */
+	struct version_key key;
+
+	/**
+	 * The order of the directory the file was found in,
+	 * in LIBRARIAN_PATH, counting the directories of
+	 * databases.
+	 */
+	size_t dir;
+
+	/**
+	 * The position of the file in the index of the directory
+	 * or database it was found in. Files are sorted by version
+	 * and then by filename in an index, so this orders files
+	 * with the same version in the same directory, even if
+	 * zeros were prepended to their versions in a database.
+	 */
+	size_t order;
+
+	/**
+	 * 1 if `deps` has been loaded, -1 if the
+	 * file's dependency list is malformed,
+	 * 0 if it has not been loaded yet.
+	 */
+	int deps_state;
+
+	/**
+	 * The value of the file's `deps` variable.
+	 */
+	char *deps_string;
+
+	/**
+	 * The libraries listed in `deps_string`.
+	 */
+	struct library *deps_specs;
+
+	/**
+	 * The number of elements in `deps_specs`.
+	 */
+	size_t deps_specs_count;
+
+	/**
+	 * The dependencies, one group per library.
+	 */
+	struct group *deps;
+
+	/**
+	 * The number of elements in `deps`.
+	 */
+	size_t deps_count;
+
+	/**
+	 * The indices of the learned nogoods
+	 * that watch the candidate.
+	 */
+	size_t *nogoods;
+
+	/**
+	 * The number of elements in `nogoods`.
+	 */
+	size_t nogoods_count;
+
+	/**
+	 * The allocation size of `nogoods`.
+	 */
+	size_t nogoods_size;
+};
+
+
+/**
+ * The versions of a library that are accepted by one
+ * source: the command line or a librarian file. The
+ * versions and version ranges in a group are unioned.
+ */
+struct group {
+	/**
+	 * The versions and version ranges.
+	 */
+	struct library *specs;
+
+	/**
+	 * The number of elements in `specs`.
+	 */
+	size_t n;
+
+	/**
+	 * The library.
+	 */
+	struct package *pkg;
+
+	/**
+	 * For each candidate of `pkg`, whether it
+	 * is accepted, `NULL` until needed.
+	 */
+	unsigned char *accepted;
+};
+
+
+/**
+ * A group that is in effect for a library.
+ */
+struct constraint {
+	/**
+	 * The decision level of the source,
+	 * 0 for the command line.
+	 */
+	size_t level;
+
+	/**
+	 * The accepted versions.
+	 */
+	struct group *group;
+
+	/**
+	 * For each candidate, whether it is accepted by
+	 * this and all constraints below it on the stack.
+	 */
+	unsigned char *allowed;
+
+	/**
+	 * The number of candidates in `allowed`.
+	 */
+	size_t allowed_count;
+};
+
+
+/**
+ * A library known to the dependency resolver.
+ */
+struct package {
+	/**
+	 * The name of the library.
+	 */
+	const char *name;
+
+	/**
+	 * The librarian files for the library,
+	 * in order of preference, `NULL` until
+	 * they have been looked up.
+	 */
+	struct candidate *cands;
+
+	/**
+	 * The number of elements in `cands`.
+	 */
+	size_t cands_count;
+
+	/**
+	 * The decision level at which a version
+	 * was selected, 0 if none is selected.
+	 */
+	size_t level;
+
+	/**
+	 * The index of the selected candidate.
+	 */
+	size_t chosen;
+
+	/**
+	 * The index of the next candidate to try.
+	 */
+	size_t next;
+
+	/**
+	 * The decision levels responsible for
+	 * rejecting the candidates tried so far.
+	 */
+	size_t *conflicts;
+
+	/**
+	 * The number of elements in `conflicts`.
+	 */
+	size_t conflicts_count;
+
+	/**
+	 * The allocation size of `conflicts`.
+	 */
+	size_t conflicts_size;
+
+	/**
+	 * Stack of constraints in effect,
+	 * in ascending decision level.
+	 */
+	struct constraint *cons;
+
+	/**
+	 * The number of elements in `cons`.
+	 */
+	size_t cons_count;
+
+	/**
+	 * The allocation size of `cons`.
+	 */
+	size_t cons_size;
+
+	/**
+	 * Has the library been added to `found_files`?
+	 */
+	int listed;
+};
+
+
+/**
+ * A selection of a version of a library.
+ */
+struct selection {
+	/**
+	 * The library.
+	 */
+	struct package *pkg;
+
+	/**
+	 * The index of the selected candidate.
+	 */
+	size_t cand;
+};
+
+
+/**
+ * A combination of selections that has been
+ * learned to not be part of any solution.
+ */
+struct nogood {
+	/**
+	 * The selections.
+	 */
+	struct selection *sels;
+
+	/**
+	 * The number of elements in `sels`.
+	 */
+	size_t n;
+
+	/**
+	 * The indices, in `sels`, of the two selections the
+	 * nogood is listed under; the nogood is only examined
+	 * when one of them is about to be made, and then, if
+	 * possible, moved to a selection that has not been made.
+	 */
+	size_t watch[2];
+};
+
+
+/**
+ * A library that is required by a source.
+ */
+struct requirement {
+	/**
+	 * The library.
+	 */
+	struct package *pkg;
+
+	/**
+	 * The decision level of the source,
+	 * 0 for the command line.
+	 */
+	size_t level;
+};
+
+
+/**
+ * The state of the dependency resolver.
+ */
+struct resolver {
+	/**
+	 * The context.
+	 */
+	struct librarian *ctx;
+
+	/**
+	 * LIBRARIAN_PATH.
+	 */
+	char *path;
+
+	/**
+	 * Are older versions prefered?
+	 */
+	int oldest;
+
+	/**
+	 * Hash table of all known libraries.
+	 */
+	struct package **table;
+
+	/**
+	 * The number of slots in `table` less one.
+	 */
+	size_t mask;
+
+	/**
+	 * The number of used slots in `table`.
+	 */
+	size_t count;
+
+	/**
+	 * The groups from the command line.
+	 */
+	struct group *root;
+
+	/**
+	 * The number of elements in `root`.
+	 */
+	size_t root_count;
+
+	/**
+	 * The selected libraries, indexed by
+	 * decision level; element 0 is unused.
+	 */
+	struct package **levels;
+
+	/**
+	 * The current decision level.
+	 */
+	size_t depth;
+
+	/**
+	 * The allocation size of `levels`.
+	 */
+	size_t levels_size;
+
+	/**
+	 * The required libraries, in the order
+	 * they became required.
+	 */
+	struct requirement *required;
+
+	/**
+	 * The number of elements in `required`.
+	 */
+	size_t required_count;
+
+	/**
+	 * The allocation size of `required`.
+	 */
+	size_t required_size;
+
+	/**
+	 * The learned nogoods.
+	 */
+	struct nogood *nogoods;
+
+	/**
+	 * The number of elements in `nogoods`.
+	 */
+	size_t nogoods_count;
+
+	/**
+	 * The allocation size of `nogoods`.
+	 */
+	size_t nogoods_size;
+};
+
+
+
+/**
+ * Work shared by the threads that scan
+ * the directories in LIBRARIAN_PATH.
+ */
+struct scan {
+	/**
+	 * The context.
+	 */
+	struct librarian *ctx;
+
+	/**
+	 * The sought libraries.
+	 */
+	struct library *libs;
+
+	/**
+	 * The number of elements in `libs`.
+	 */
+	size_t n;
+
+	/**
+	 * Are older versions prefered?
+	 */
+	int oldest;
+
+	/**
+	 * The directories, or the files
+	 * if `parsed` is set.
+	 */
+	char **dirs;
+
+	/**
+	 * The number of elements in `dirs`.
+	 */
+	size_t dirs_count;
+
+	/**
+	 * For each directory, `n` elements with the best
+	 * file for each library. `NULL` if the directories
+	 * shall be indexed rather than searched.
+	 */
+	char **found;
+
+	/**
+	 * The version keys of the files in `found`.
+	 */
+	struct version_key *found_keys;
+
+	/**
+	 * For each directory, its index, unless
+	 * `found` or `parsed` is set.
+	 */
+	struct dir_index *loaded;
+
+	/**
+	 * For each file, the loaded file, `NULL` if
+	 * it could not be loaded. `NULL` if directories
+	 * rather than files shall be scanned.
+	 */
+	struct parsed_file **parsed;
+
+	/**
+	 * For each directory, the error that occurred
+	 * when scanning it, 0 if none.
+	 */
+	int *errors;
+
+	/**
+	 * The index of the next directory to scan.
+	 */
+	size_t next;
+
+	/**
+	 * Mutex for `next`.
+	 */
+	pthread_mutex_t lock;
+};
+
+
+
+/**
+ * Counters for LIBRARIAN_TRACE.
+ */
+struct trace_counters {
+	/**
+	 * The number of directories opened.
+	 */
+	unsigned long long dirs_opened;
+
+	/**
+	 * The number of directory entries examined.
+	 */
+	unsigned long long dirents;
+
+	/**
+	 * The number of files opened.
+	 */
+	unsigned long long files_opened;
+
+	/**
+	 * The number of bytes read from files.
+	 */
+	unsigned long long bytes_read;
+
+	/**
+	 * The number of version comparisons.
+	 */
+	unsigned long long version_cmps;
+
+	/**
+	 * The number of memory allocations.
+	 */
+	unsigned long long allocations;
+};
+
+
+/**
+ * A round of find_librarian_files(), for LIBRARIAN_TRACE.
+ */
+struct trace_round {
+	/**
+	 * The number of microseconds the round took.
+	 */
+	double time;
+
+	/**
+	 * The number of library specifications sought.
+	 */
+	size_t libraries;
+
+	/**
+	 * The number of librarian files found.
+	 */
+	size_t found;
+
+	/**
+	 * The counters, at the beginning of the
+	 * round, and then for the round only.
+	 */
+	struct trace_counters counters;
+};
+
+
+/**
+ * The trace of a query, for LIBRARIAN_TRACE.
+ */
+struct trace {
+	/**
+	 * Is a query being traced?
+	 */
+	int active;
+
+	/**
+	 * Was the trace started by librarian_resolve(),
+	 * rather than by librarian_trace_begin()?
+	 */
+	int implicit;
+
+	/**
+	 * The exit status of the query, for
+	 * traces started by librarian_resolve().
+	 */
+	int status;
+
+	/**
+	 * The arguments, as a JSON array.
+	 */
+	char *argv;
+
+	/**
+	 * When the query began, in microseconds.
+	 */
+	double start;
+
+	/**
+	 * The number of microseconds spent
+	 * parsing the arguments.
+	 */
+	double parse_time;
+
+	/**
+	 * The number of microseconds spent
+	 * resolving conflicts between versions.
+	 */
+	double resolve_time;
+
+	/**
+	 * The number of microseconds spent
+	 * in get_variables().
+	 */
+	double variables_time;
+
+	/**
+	 * The rounds of find_librarian_files().
+	 */
+	struct trace_round *rounds;
+
+	/**
+	 * The number of elements in `rounds`.
+	 */
+	size_t rounds_count;
+
+	/**
+	 * The allocation size of `rounds`.
+	 */
+	size_t rounds_size;
+};
+
+
+/**
+ * A block of memory in an arena.
+ */
+struct arena_chunk {
+	/**
+	 * The previously allocated block, `NULL` if none.
+	 */
+	struct arena_chunk *prev;
+
+	/**
+	 * The size of `data`.
+	 */
+	size_t size;
+
+	/**
+	 * The number of bytes used in `data`.
+	 */
+	size_t used;
+
+	/**
+	 * The memory.
+	 */
+	union {
+		void *p;
+		uint64_t u;
+		long double d;
+	} data[];
+};
+
+
+/**
+ * Memory that is allocated piece by piece,
+ * and released all at once.
+ */
+struct arena {
+	/**
+	 * The most recently allocated block,
+	 * `NULL` if none.
+	 */
+	struct arena_chunk *chunk;
+
+	/**
+	 * Hash table of the strings that have
+	 * been interned in the arena.
+	 */
+	const char **strings;
+
+	/**
+	 * The number of slots in `strings` less one.
+	 */
+	size_t mask;
+
+	/**
+	 * The number of used slots in `strings`.
+	 */
+	size_t count;
+};
+
+
+/**
+ * A context, everything librarian knows.
+ */
+struct librarian {
+	/**
+	 * LIBRARIAN_PATH, `NULL` if empty.
+	 */
+	char *path;
+
+	/**
+	 * The directory index files are stored in,
+	 * `NULL` if directories shall not be indexed.
+	 */
+	char *index_dir;
+
+	/**
+	 * The maximum number of threads to use
+	 * when scanning LIBRARIAN_PATH.
+	 */
+	long jobs;
+
+	/**
+	 * Shall directories be indexed in memory even
+	 * if index files are not used?
+	 */
+	int in_memory_indices;
+
+	/**
+	 * Shall located librarian files be read ahead,
+	 * because they will be loaded during resolution?
+	 */
+	int prefetch;
+
+	/**
+	 * Shall librarian files and databases be read
+	 * into memory, rather than mapped?
+	 */
+	int copy_files;
+
+	/**
+	 * Function to call before a directory is indexed,
+	 * `NULL` if directories are not watched.
+	 */
+	int (*watch_directory)(void *data, const char *path);
+
+	/**
+	 * The first argument for `watch_directory`.
+	 */
+	void *watch_data;
+
+	/**
+	 * The io_uring instance used to open
+	 * librarian files, `NULL` until used.
+	 */
+	struct file_ring *ring;
+
+	/**
+	 * Hash table of loaded librarian files.
+	 */
+	struct parsed_file **files;
+
+	/**
+	 * The number of slots in `files` less one.
+	 */
+	size_t files_mask;
+
+	/**
+	 * The number of used slots in `files`.
+	 */
+	size_t files_count;
+
+	/**
+	 * Indices of directories that have been searched.
+	 */
+	struct dir_index *indices;
+
+	/**
+	 * The number of elements in `indices`.
+	 */
+	size_t indices_count;
+
+	/**
+	 * Already located librarian files, sorted by
+	 * name once all have been found.
+	 */
+	struct found_file *found_files;
+
+	/**
+	 * The number of elements in `found_files`.
+	 */
+	size_t found_files_count;
+
+	/**
+	 * The allocation size of `found_files`.
+	 */
+	size_t found_files_size;
+
+	/**
+	 * Hash table of the names in `found_files`, each
+	 * used slot holds the index of a file plus 1.
+	 */
+	size_t *found_map;
+
+	/**
+	 * The number of slots in `found_map` less one.
+	 */
+	size_t found_map_mask;
+
+	/**
+	 * The libraries sought by the last call
+	 * to librarian_resolve(), and their
+	 * dependencies.
+	 */
+	struct library *libraries;
+
+	/**
+	 * The number of elements in `libraries`.
+	 */
+	size_t libraries_count;
+
+	/**
+	 * The allocation size of `libraries`.
+	 */
+	size_t libraries_size;
+
+	/**
+	 * Memory for the result of the last call to
+	 * librarian_resolve(), including the strings
+	 * that `libraries` point into, and the
+	 * pathnames in `found_files` and `consulted`.
+	 */
+	struct arena arena;
+
+	/**
+	 * Buffer for get_variables().
+	 */
+	struct variable *parts;
+
+	/**
+	 * The allocation size of `parts`.
+	 */
+	size_t parts_size;
+
+	/**
+	 * The dependency resolver, `NULL` unless
+	 * it has been used.
+	 */
+	struct resolver *resolver;
+
+	/**
+	 * The library that could not be found,
+	 * `NULL` if none.
+	 */
+	char *missing;
+
+	/**
+	 * The directories and files the result of the
+	 * last call to librarian_resolve() depends on.
+	 */
+	const char **consulted;
+
+	/**
+	 * The number of elements in `consulted`.
+	 */
+	size_t consulted_count;
+
+	/**
+	 * The allocation size of `consulted`.
+	 */
+	size_t consulted_size;
+
+	/**
+	 * The number of calls to librarian_resolve()
+	 * that have been made.
+	 */
+	unsigned long long query;
+
+	/**
+	 * The file to append traces of queries to,
+	 * `NULL` if queries shall not be traced.
+	 */
+	char *trace_path;
+
+	/**
+	 * Counters for the current query,
+	 * only updated if `trace_path` is set.
+	 */
+	struct trace_counters counters;
+
+	/**
+	 * The trace of the current query.
+	 */
+	struct trace trace;
+};
+
+
+
+/**
+ * Value of `struct index_header.magic`.
+ */
+#define INDEX_MAGIC  "LIBRIDX2"
+
+/**
+ * Value of `struct db_header.index.magic`.
+ */
+#define DB_MAGIC  "LIBRDB02"
+
+
+
+/**
+ * The counters of the context the thread is working
+ * for, `NULL` if queries are not traced. Set by
+ * enter(), so that functions that do not take a context,
+ * such as comparison functions for qsort(3), can count.
+ */
+static __thread struct trace_counters *counting = NULL;
+
+
+
+/**
+ * Add to a counter in `counting`, if queries are
+ * traced. Safe to use from multiple threads.
+ * 
+ * @param  FIELD  The name of the counter.
+ * @param  N      The value to add.
+ */
+#define COUNT(FIELD, N)  \
+	((void)(counting && __atomic_fetch_add(&counting->FIELD, (unsigned long long)(N), __ATOMIC_RELAXED)))
+
+
+/**
+ * Allocate memory with malloc(3), and count the allocation.
+ * All allocations in this file are counted.
+ * 
+ * @param   n  The number of bytes.
+ * @return     The memory, `NULL` on error.
+ */
+static void *counted_malloc(size_t n)
+{
+	COUNT(allocations, 1);
+	return malloc(n);
+}
+
+
+/**
+ * Allocate zeroed memory with calloc(3),
+ * and count the allocation.
+ * 
+ * @param   n     The number of elements.
+ * @param   size  The size of each element.
+ * @return        The memory, `NULL` on error.
+ */
+static void *counted_calloc(size_t n, size_t size)
+{
+	COUNT(allocations, 1);
+	return calloc(n, size);
+}
+
+
+/**
+ * Resize memory with realloc(3), and count the
+ * allocation. Used by REALLOC(), GROW() and
+ * MAYBE_GROW() in this file.
+ * 
+ * @param   ptr  The memory, may be `NULL`.
+ * @param   n    The new number of bytes.
+ * @return       The memory, `NULL` on error.
+ */
+static void *counted_realloc(void *ptr, size_t n)
+{
+	COUNT(allocations, 1);
+	return realloc(ptr, n);
+}
+
+
+/**
+ * Duplicate a string with strdup(3),
+ * and count the allocation.
+ * 
+ * @param   s  The string.
+ * @return     The copy, `NULL` on error.
+ */
+static char *counted_strdup(const char *s)
+{
+	COUNT(allocations, 1);
+	return strdup(s);
+}
+
+
+
+/**
+ * Start working for a context in the current thread.
+ * 
+ * @param  ctx  The context.
+ */
+static void enter(struct librarian *ctx)
+{
+	counting = ctx->trace_path ? &ctx->counters : NULL;
+}
+
+
+/**
+ * Get the time, for LIBRARIAN_TRACE.
+ * 
+ * @param   ctx  The context.
+ * @return       The time of a monotonic clock, in microseconds,
+ *               0 if queries are not traced.
+ */
+static double trace_now(const struct librarian *ctx)
+{
+	struct timespec ts;
+	if (ctx->trace_path == NULL || clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+	return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+
+/**
+ * Compares the name, and secondarily the
+ * origin, of two libraries.
+ * 
+ * @param   a:const struct library *  One of the libraries.
+ * @param   b:const struct library *  The other library.
+ * @return                            <0: `a` < `b`.
+ *                                    =0: `a` = `b`.
+ *                                    >0: `a` > `b`.
+ */
+static int library_name_cmp(const void *a, const void *b)
+{
+	const struct library *la = a;
+	const struct library *lb = b;
+	int r = strcmp(la->name, lb->name);
+	if (r)
+		return r;
+	return la->origin < lb->origin ? -1 : la->origin > lb->origin;
+}
+
+
+/**
+ * Compares the name of two `struct found_file`.
+ * 
+ * @param   a:const struct found_file *  One of the files.
+ * @param   b:const struct found_file *  The other file.
+ * @return                               <0: `a` < `b`.
+ *                                       =0: `a` = `b`.
+ *                                       >0: `a` > `b`.
+ */
+static int found_file_name_cmp(const void *a, const void *b)
+{
+	const struct found_file *fa = a;
+	const struct found_file *fb = b;
+	return strcmp(fa->name, fb->name);
+}
+
+
+/**
+ * Determine whether a string is the
+ * name of a non-reserved variable.
+ * 
+ * @param   s  The string.
+ * @return     1: The string is a varible name.
+ *             0: The string is a library.
+ */
+int librarian_is_variable(const char *s)
+{
+	for (; *s; s++)
+		if (!isupper(*s) && !isdigit(*s) && !strchr("_-", *s))
+			return 0;
+	return 1;
+}
+
+
+/**
+ * Append a segment to a version key.
+ * 
+ * @param  runs  The runs of the key.
+ * @param  cap   The number of elements in `runs`, runs
+ *               beyond it are counted but not stored.
+ * @param  n     The number of runs in the key, will be updated.
+ * @param  s     The beginning of the segment.
+ * @param  end   The end of the segment.
+ */
+static void add_version_segment(struct version_run *runs, size_t cap, size_t *n, const char *s, const char *end)
+{
+	size_t head = (*n)++;
+	const char *q;
+
+	while (s != end) {
+		for (q = s; q != end && isdigit(*q); q++);
+		while (s != q && *s == '0')
+			s++;
+		if (*n < cap) {
+			runs[*n].str = s;
+			runs[*n].len = (size_t)(q - s);
+		}
+		++*n;
+		if ((s = q) == end)
+			break;
+		for (; q != end && !isdigit(*q); q++);
+		if (*n < cap) {
+			runs[*n].str = s;
+			runs[*n].len = (size_t)(q - s);
+		}
+		++*n;
+		s = q;
+	}
+	if (head < cap) {
+		runs[head].str = NULL;
+		runs[head].len = *n - head - 1;
+	}
+}
+
+
+/**
+ * Split a version number into runs.
+ * 
+ * @param  runs     The runs of the key.
+ * @param  cap      The number of elements in `runs`, runs
+ *                  beyond it are counted but not stored.
+ * @param  n        Output parameter for the number of runs.
+ * @param  version  The version number.
+ */
+static void split_version(struct version_run *runs, size_t cap, size_t *n, const char *version)
+{
+	const char *epoch = strchr(version, ':');
+	const char *s = epoch ? (epoch + 1) : version;
+	const char *end;
+
+	*n = 0;
+	add_version_segment(runs, cap, n, version, epoch ? epoch : version);
+	for (;;) {
+		end = strchr(s, '.');
+		add_version_segment(runs, cap, n, s, end ? end : strchr(s, '\0'));
+		if (end == NULL)
+			break;
+		s = end + 1;
+	}
+}
+
+
+/**
+ * Split a version number into a version key.
+ * 
+ * The key is split into `small`, and only if it has
+ * more than `VERSION_KEY_RUNS` runs, which are counted
+ * as it is split, it is split again into an allocation
+ * of the exact size.
+ * 
+ * @param   key      Output parameter for the key, shall be
+ *                   released with free_version_key().
+ * @param   version  The version number.
+ * @return           0 on success, -1 on error.
+ */
+static int make_version_key(struct version_key *key, const char *version)
+{
+	key->heap = NULL;
+	split_version(key->small, VERSION_KEY_RUNS, &key->count, version);
+	if (key->count > VERSION_KEY_RUNS) {
+		key->heap = counted_malloc(key->count * sizeof(*key->heap));
+		if (key->heap == NULL)
+			return key->count = 0, -1;
+		split_version(key->heap, key->count, &key->count, version);
+	}
+	return 0;
+}
+
+
+/**
+ * Release a version key.
+ * 
+ * @param  key  The key.
+ */
+static void free_version_key(struct version_key *key)
+{
+	free(key->heap);
+	key->heap = NULL;
+	key->count = 0;
+}
+
+
+/**
+ * Compare two version keys. A missing run or segment
+ * compares equal to an empty one, a run of digits is
+ * compared numerically, and a run of non-digits is
+ * compared lexicographically.
+ * 
+ * @param   a  One of the version keys.
+ * @param   b  The other version key.
+ * @return     <0: `a` < `b`.
+ *             =0: `a` = `b`.
+ *             >0: `a` > `b`.
+ */
+static int version_key_cmp(const struct version_key *a, const struct version_key *b)
+{
+	static const struct version_run empty = { "", 0 };
+	const struct version_run *ar = a->heap ? a->heap : a->small;
+	const struct version_run *br = b->heap ? b->heap : b->small;
+	const struct version_run *x;
+	const struct version_run *y;
+	size_t i = 0, j = 0, an, bn, k;
+	int r;
+
+	COUNT(version_cmps, 1);
+	while (i < a->count || j < b->count) {
+		an = i < a->count ? ar[i++].len : 0;
+		bn = j < b->count ? br[j++].len : 0;
+		for (k = 0; k < an || k < bn; k++) {
+			x = k < an ? (ar + i + k) : &empty;
+			y = k < bn ? (br + j + k) : &empty;
+			if ((k & 1) == 0 && x->len != y->len)
+				return x->len < y->len ? -1 : +1;
+			r = memcmp(x->str, y->str, x->len < y->len ? x->len : y->len);
+			if (r)
+				return r;
+			if (x->len != y->len)
+				return x->len < y->len ? -1 : +1;
+		}
+		i += an;
+		j += bn;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Parse a library–library-version range
+ * argument.
+ * 
+ * @param   s    The string.
+ * @param   lib  Output parameter for the library spec:s, shall
+ *               be released with free_library().
+ * @return        0: Successful.
+ *                1: Syntax error.
+ *               -1: An error occurred.
+ */
+static int parse_library(char *s, struct library *lib)
+{
+	char *p;
+	char c;
+
+	memset(lib, 0, sizeof(*lib));
+
+	if (strchr(s, '/') || strchr("<>=", *s))
+		return 1;
+
+	lib->name = s;
+	p = strpbrk(s, "<>=");
+	if (p == NULL)
+		return 0;
+	c = *p, *p++ = '\0';
+
+	switch (c) {
+	case '=':
+		lib->lower_closed = lib->upper_closed = 1;
+		lib->lower = lib->upper = p;
+		break;
+	case '>':
+		p += lib->lower_closed = (*p == '=');
+		lib->lower = p;
+		s = strchr(p, '<');
+		if (s == NULL)
+			break;
+		*s++ = '\0';
+		if (!*(p = s))
+			goto keys;
+		/* fall through */
+	case '<':
+		p += lib->upper_closed = (*p == '=');
+		lib->upper = p;
+		break;
+	default:
+		NEVER_REACHED;
+		break;
+	}
+
+	if (strpbrk(p, "<>=") || !*p)
+		return 1;
+keys:
+	if (lib->lower && make_version_key(&lib->lower_key, lib->lower))
+		return -1;
+	/* NAME=VER has the same string at both ends, and shares the key. */
+	if (lib->upper && (lib->upper != lib->lower) && make_version_key(&lib->upper_key, lib->upper))
+		return free_version_key(&lib->lower_key), -1;
+	return 0;
+}
+
+
+/**
+ * Release the version keys of a library spec.
+ * 
+ * @param  lib  The library spec.
+ */
+static void free_library(struct library *lib)
+{
+	free_version_key(&lib->lower_key);
+	free_version_key(&lib->upper_key);
+}
+
+
+/**
+ * Test whether a version of a library is not
+ * below the lower end of a version range.
+ * 
+ * @param   version   The found version.
+ * @param   required  Compatible version range.
+ * @return            1: Version is not too old.
+ *                    0: Version is too old.
+ */
+static int test_lower_bound(const struct version_key *version, const struct library *required)
+{
+	int lower = required->lower ? version_key_cmp(version, &required->lower_key) : +1;
+	return required->lower_closed ? (lower >= 0) : (lower > 0);
+}
+
+
+/**
+ * Test whether a version of a library is not
+ * above the upper end of a version range.
+ * 
+ * @param   version   The found version.
+ * @param   required  Compatible version range.
+ * @return            1: Version is not too new.
+ *                    0: Version is too new.
+ */
+static int test_upper_bound(const struct version_key *version, const struct library *required)
+{
+	const struct version_key *key = (required->upper == required->lower) ? &required->lower_key : &required->upper_key;
+	int upper = required->upper ? version_key_cmp(version, key) : -1;
+	return required->upper_closed ? (upper <= 0) : (upper < 0);
+}
+
+
+/**
+ * Test whether a version of a library is compatible.
+ * 
+ * @param   version   The found version.
+ * @param   required  Compatible version range.
+ * @return            1: Version is accepted.
+ *                    0: Version is incompatible.
+ */
+static int test_library_version(const struct version_key *version, const struct library *required)
+{
+	if (required->upper && (required->upper == required->lower))
+		return !version_key_cmp(version, &required->lower_key);
+	return test_upper_bound(version, required) && test_lower_bound(version, required);
+}
+
+
+/**
+ * Calculate the FNV-1a hash of a string.
+ * 
+ * @param   s  The string.
+ * @return     The hash of the string.
+ */
+static uint64_t hash_string(const char *s)
+{
+	uint64_t h = UINT64_C(0xCBF29CE484222325);
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * UINT64_C(0x100000001B3);
+	return h;
+}
+
+
+/**
+ * Calculate the FNV-1a hash of a memory segment.
+ * 
+ * @param   s  The memory segment.
+ * @param   n  The size of `s`.
+ * @return     The hash of the memory segment.
+ */
+static uint64_t hash_data(const char *s, size_t n)
+{
+	uint64_t h = UINT64_C(0xCBF29CE484222325);
+	while (n--)
+		h = (h ^ (unsigned char)*s++) * UINT64_C(0x100000001B3);
+	return h;
+}
+
+
+/**
+ * Allocate memory in an arena.
+ * 
+ * @param   arena  The arena.
+ * @param   n      The number of bytes to allocate.
+ * @return         The memory, suitably aligned for any
+ *                 type, `NULL` on error. It is released
+ *                 by arena_release().
+ */
+static void *arena_alloc(struct arena *arena, size_t n)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	size_t size;
+	void *rc;
+
+	n = (n + sizeof(*chunk->data) - 1) / sizeof(*chunk->data) * sizeof(*chunk->data);
+	if (chunk == NULL || chunk->size - chunk->used < n) {
+		size = chunk ? 2 * chunk->size : 4096;
+		size = size < n ? n : size;
+		chunk = counted_malloc(sizeof(*chunk) + size);
+		if (chunk == NULL)
+			return NULL;
+		chunk->prev = arena->chunk;
+		chunk->size = size;
+		chunk->used = 0;
+		arena->chunk = chunk;
+	}
+	rc = (char *)(chunk->data) + chunk->used;
+	chunk->used += n;
+	return rc;
+}
+
+
+/**
+ * Copy a string into an arena.
+ * 
+ * @param   arena  The arena.
+ * @param   s      The string.
+ * @param   n      The length of `s`, `s` need
+ *                 not be NUL-terminated.
+ * @return         The copy, `NULL` on error.
+ */
+static char *arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+	char *rc = arena_alloc(arena, n + 1);
+	if (rc != NULL) {
+		memcpy(rc, s, n);
+		rc[n] = '\0';
+	}
+	return rc;
+}
+
+
+/**
+ * Get the copy of a string in an arena, so that
+ * each distinct string is only stored once.
+ * 
+ * @param   arena  The arena.
+ * @param   s      The string.
+ * @param   n      The length of `s`, `s` need
+ *                 not be NUL-terminated.
+ * @return         The copy, `NULL` on error.
+ */
+static const char *arena_intern(struct arena *arena, const char *s, size_t n)
+{
+	const char **table;
+	const char *str;
+	size_t h, i, mask;
+
+	if (2 * (arena->count + 1) > arena->mask + 1) {
+		mask = arena->mask ? (2 * arena->mask + 1) : 63;
+		table = counted_calloc(mask + 1, sizeof(*table));
+		if (table == NULL)
+			return NULL;
+		for (i = 0; arena->strings && (i <= arena->mask); i++) {
+			if (arena->strings[i] == NULL)
+				continue;
+			h = (size_t)hash_string(arena->strings[i]) & mask;
+			for (; table[h]; h = (h + 1) & mask);
+			table[h] = arena->strings[i];
+		}
+		free(arena->strings);
+		arena->strings = table;
+		arena->mask = mask;
+	}
+
+	h = (size_t)hash_data(s, n) & arena->mask;
+	for (; (str = arena->strings[h]); h = (h + 1) & arena->mask)
+		if (!strncmp(str, s, n) && !str[n])
+			return str;
+	str = arena_strndup(arena, s, n);
+	if (str != NULL) {
+		arena->strings[h] = str;
+		arena->count++;
+	}
+	return str;
+}
+
+
+/**
+ * Release all memory allocated in an arena, except
+ * the largest block, which is kept for reuse.
+ * 
+ * @param  arena  The arena.
+ * @param  all    Release the largest block too?
+ */
+static void arena_release(struct arena *arena, int all)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	struct arena_chunk *prev;
+
+	if (chunk == NULL)
+		return;
+	for (prev = chunk->prev; prev; prev = chunk->prev) {
+		chunk->prev = prev->prev;
+		free(prev);
+	}
+	chunk->used = 0;
+	if (arena->strings != NULL)
+		memset(arena->strings, 0, (arena->mask + 1) * sizeof(*arena->strings));
+	arena->count = 0;
+	if (all) {
+		free(chunk);
+		free(arena->strings);
+		memset(arena, 0, sizeof(*arena));
+	}
+}
+
+
+/**
+ * Compares two filenames of librarian files,
+ * first by library name, then by version.
+ * 
+ * @param   a:const struct dir_entry *  One of the files.
+ * @param   b:const struct dir_entry *  The other file.
+ * @return                              <0: `a` < `b`.
+ *                                      =0: `a` = `b`.
+ *                                      >0: `a` > `b`.
+ */
+static int filename_cmp(const void *a, const void *b)
+{
+	const struct dir_entry *ea = a;
+	const struct dir_entry *eb = b;
+	char *va;
+	char *vb;
+	size_t la, lb;
+	int r;
+
+	GET_VERSION(va, ea->name);
+	GET_VERSION(vb, eb->name);
+	la = (size_t)(va - ea->name);
+	lb = (size_t)(vb - eb->name);
+	r = memcmp(ea->name, eb->name, la < lb ? la : lb);
+	if (r)  return r;
+	if (la != lb)  return la < lb ? -1 : +1;
+	r = version_key_cmp(&ea->key, &eb->key);
+	return r ? r : strcmp(ea->name, eb->name);
+}
+
+
+/**
+ * Get the pathname of the index file for a directory.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the directory.
+ * @return        The pathname of the index file, `NULL` on error.
+ */
+static char *index_file(const struct librarian *ctx, const char *path)
+{
+	char *rc = counted_malloc(strlen(ctx->index_dir) + 18);
+	if (rc != NULL)
+		sprintf(rc, "%s/%016llx", ctx->index_dir, (unsigned long long int)hash_string(path));
+	return rc;
+}
+
+
+/**
+ * Check that the content of an index file is
+ * well-formed and describes the current state
+ * of the indexed directory.
+ * 
+ * @param   idx  The index, `idx->data` and `idx->size` must be set.
+ * @param   st   The status of the indexed directory.
+ * @return       1: The index is valid and up to date.
+ *               0: The index is corrupt or stale.
+ */
+static int check_index(struct dir_index *idx, const struct stat *st)
+{
+	struct index_header *head = (struct index_header *)(idx->data);
+	size_t strings, i;
+
+	if (idx->size < sizeof(*head) || memcmp(head->magic, INDEX_MAGIC, sizeof(head->magic)))
+		return 0;
+	if ((head->size != idx->size) ||
+	    (head->dev != (uint64_t)(st->st_dev)) || (head->ino != (uint64_t)(st->st_ino)) ||
+	    (head->mtime[0] != (int64_t)(st->st_mtim.tv_sec)) || (head->mtime[1] != (int64_t)(st->st_mtim.tv_nsec)) ||
+	    (head->ctime[0] != (int64_t)(st->st_ctim.tv_sec)) || (head->ctime[1] != (int64_t)(st->st_ctim.tv_nsec)))
+		return 0;
+	if ((head->names > idx->size / sizeof(*idx->names)) || (head->entries > idx->size / sizeof(*idx->entries)))
+		return 0;
+	strings = sizeof(*head) + (size_t)(head->names) * sizeof(*idx->names);
+	strings += (size_t)(head->entries) * sizeof(*idx->entries);
+	if ((strings > idx->size) || ((strings < idx->size) && idx->data[idx->size - 1]))
+		return 0;
+
+	idx->names = (struct index_name *)(idx->data + sizeof(*head));
+	idx->entries = (uint64_t *)(idx->names + head->names);
+	for (i = 0; i < head->names; i++)
+		if ((idx->names[i].name < strings) || (idx->names[i].name >= idx->size) ||
+		    (idx->names[i].first > head->entries) ||
+		    (idx->names[i].count > head->entries - idx->names[i].first))
+			return 0;
+	for (i = 0; i < head->entries; i++)
+		if ((idx->entries[i] < strings) || (idx->entries[i] >= idx->size) ||
+		    !strchr(idx->data + idx->entries[i], '='))
+			return 0;
+	return 1;
+}
+
+
+/**
+ * Check whether an index may be missing changes made to its
+ * directory, because the directory was modified in the same
+ * second as the index was built. Timestamps can be too coarse
+ * to tell whether such a modification happened before or after
+ * the directory was read, so such an index cannot be trusted
+ * in later queries.
+ * 
+ * @param   st     The status of the directory recorded in the index.
+ * @param   built  The time, in whole seconds, the index was built.
+ * @return         1 if the index is racy, 0 otherwise.
+ */
+static int racy_index(const struct stat *st, time_t built)
+{
+	return (st->st_mtim.tv_sec >= built) || (st->st_ctim.tv_sec >= built);
+}
+
+
+/**
+ * Load the index file for a directory.
+ * 
+ * @param   ctx  The context.
+ * @param   idx  Output parameter for the index, `idx->path` must be set.
+ * @param   st   The status of the directory.
+ * @return       1: The index was loaded.
+ *               0: There is no up to date index.
+ *               -1: An error occurred.
+ */
+static int load_index(const struct librarian *ctx, struct dir_index *idx, const struct stat *st)
+{
+	char *file = NULL;
+	int fd = -1;
+	struct stat fst;
+	void *map;
+
+	file = index_file(ctx, idx->path);
+	t (file == NULL);
+	fd = open(file, O_RDONLY);
+	free(file), file = NULL;
+	if (fd == -1) {
+		t (errno != ENOENT);
+		return 0;
+	}
+	COUNT(files_opened, 1);
+	t (fstat(fd, &fst));
+	if ((size_t)(fst.st_size) < sizeof(struct index_header))
+		goto stale;
+	map = mmap(NULL, (size_t)(fst.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	t (map == MAP_FAILED);
+	close(fd), fd = -1;
+	COUNT(bytes_read, fst.st_size);
+
+	idx->data = map;
+	idx->size = (size_t)(fst.st_size);
+	idx->mapped = 1;
+	if (check_index(idx, st) && !racy_index(st, fst.st_mtim.tv_sec))
+		return 1;
+	munmap(idx->data, idx->size);
+	idx->data = NULL;
+	return 0;
+
+stale:
+	close(fd);
+	return 0;
+fail:
+	RETURN (-1) {
+	if (fd >= 0)
+		close(fd);
+	}
+}
+
+
+/**
+ * Replace a file atomically, by writing
+ * a new file and renaming it.
+ * 
+ * @param   file  The pathname of the file.
+ * @param   data  The new content of the file.
+ * @param   size  The size of `data`.
+ * @param   mode  The permissions of the new file.
+ * @return        0 on success, -1 on error.
+ */
+static int replace_file(const char *file, const char *data, size_t size, mode_t mode)
+{
+	char *temp = NULL;
+	int fd = -1, created = 0, r;
+	size_t off;
+	ssize_t n;
+
+	temp = counted_malloc(strlen(file) + sizeof(".XXXXXX"));
+	t (temp == NULL);
+	stpcpy(stpcpy(temp, file), ".XXXXXX");
+	fd = mkstemp(temp);
+	t (fd == -1);
+	created = 1;
+	t (fchmod(fd, mode));
+
+	for (off = 0; off < size; off += (size_t)n) {
+		n = write(fd, data + off, size - off);
+		t (n < 0);
+	}
+	r = close(fd), fd = -1;
+	t (r || rename(temp, file));
+
+	free(temp);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (fd >= 0)
+		close(fd);
+	if (created)
+		unlink(temp);
+	free(temp);
+	}
+}
+
+
+/**
+ * Save an index to its index file.
+ * 
+ * Failure is ignored, as the index
+ * file is only a cache.
+ * 
+ * @param  ctx  The context.
+ * @param  idx  The index.
+ */
+static void save_index(const struct librarian *ctx, const struct dir_index *idx)
+{
+	char *file;
+
+	if (mkdir(ctx->index_dir, 0755) && (errno != EEXIST))
+		return;
+	file = index_file(ctx, idx->path);
+	if (file != NULL)
+		replace_file(file, idx->data, idx->size, 0600);
+	free(file);
+}
+
+
+/**
+ * Create an index of a directory.
+ * 
+ * @param   idx  Output parameter for the index, `idx->path` must be set.
+ * @param   st   The status of the directory, taken before it is read.
+ * @return       0 on success, -1 on error.
+ */
+static int build_index(struct dir_index *idx, const struct stat *st)
+{
+	DIR *d = NULL;
+	struct dirent *f;
+	struct dir_entry *files = NULL;
+	size_t files_ptr = 0;
+	size_t files_size = 0;
+	size_t names = 0;
+	size_t strings = 0;
+	size_t i, len, off;
+	struct index_header *head;
+	struct index_name *name = NULL;
+	char *ver;
+
+	d = opendir(idx->path);
+	t (d == NULL);
+	COUNT(dirs_opened, 1);
+	while ((f = (errno = 0, readdir(d)))) {
+		COUNT(dirents, 1);
+		if (!strrchr(f->d_name, '='))
+			continue;
+		MAYBE_GROW(files, files_ptr, files_size, 64);
+		files[files_ptr].name = counted_strdup(f->d_name);
+		t (files[files_ptr].name == NULL);
+		GET_VERSION(ver, files[files_ptr].name);
+		if (make_version_key(&files[files_ptr].key, ver + 1)) {
+			free(files[files_ptr].name);
+			goto fail;
+		}
+		strings += strlen(files[files_ptr++].name) + 1;
+	}
+	t (errno);
+	closedir(d), d = NULL;
+
+	qsort(files, files_ptr, sizeof(*files), filename_cmp);
+	for (i = 0; i < files_ptr; i++) {
+		GET_VERSION(ver, files[i].name);
+		len = (size_t)(ver - files[i].name);
+		if (!i || strncmp(files[i - 1].name, files[i].name, len + 1))
+			names++, strings += len + 1;
+	}
+
+	idx->size = sizeof(*head) + names * sizeof(*idx->names) + files_ptr * sizeof(*idx->entries) + strings;
+	idx->data = counted_calloc(idx->size, 1);
+	t (idx->data == NULL);
+	idx->mapped = 0;
+	head = (struct index_header *)(idx->data);
+	idx->names = (struct index_name *)(idx->data + sizeof(*head));
+	idx->entries = (uint64_t *)(idx->names + names);
+
+	memcpy(head->magic, INDEX_MAGIC, sizeof(head->magic));
+	head->dev = (uint64_t)(st->st_dev);
+	head->ino = (uint64_t)(st->st_ino);
+	head->mtime[0] = (int64_t)(st->st_mtim.tv_sec);
+	head->mtime[1] = (int64_t)(st->st_mtim.tv_nsec);
+	head->ctime[0] = (int64_t)(st->st_ctim.tv_sec);
+	head->ctime[1] = (int64_t)(st->st_ctim.tv_nsec);
+	head->names = (uint64_t)names;
+	head->entries = (uint64_t)files_ptr;
+	head->size = (uint64_t)(idx->size);
+
+	off = (size_t)((char *)(idx->entries + files_ptr) - idx->data);
+	for (i = 0; i < files_ptr; i++) {
+		GET_VERSION(ver, files[i].name);
+		len = (size_t)(ver - files[i].name);
+		if (!i || strncmp(files[i - 1].name, files[i].name, len + 1)) {
+			name = name ? (name + 1) : idx->names;
+			name->name = (uint64_t)off;
+			name->first = (uint64_t)i;
+			memcpy(idx->data + off, files[i].name, len);
+			off += len + 1;
+		}
+		name->count++;
+		idx->entries[i] = (uint64_t)off;
+		off = (size_t)(stpcpy(idx->data + off, files[i].name) - idx->data) + 1;
+	}
+
+	while (files_ptr--) {
+		free_version_key(&files[files_ptr].key);
+		free(files[files_ptr].name);
+	}
+	free(files);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	while (files_ptr--) {
+		free_version_key(&files[files_ptr].key);
+		free(files[files_ptr].name);
+	}
+	free(files);
+	if (d != NULL)
+		closedir(d);
+	}
+}
+
+
+/**
+ * Check that the content of a database file is well-formed.
+ * 
+ * @param   idx  The database, `idx->data` and `idx->size` must be set.
+ * @return       1: The database is well-formed.
+ *               0: The database is corrupt.
+ */
+static int check_database(struct dir_index *idx)
+{
+	struct db_header *head = (struct db_header *)(idx->data);
+	struct db_variable *var;
+	uint64_t entries, vars;
+	size_t strings, i;
+
+	if (idx->size < sizeof(*head) || memcmp(head->index.magic, DB_MAGIC, sizeof(head->index.magic)))
+		return 0;
+	entries = head->index.entries;
+	vars = head->variables;
+	if ((head->index.size != idx->size) || (head->index.names > idx->size / sizeof(*idx->names)) ||
+	    (entries > idx->size / (sizeof(*idx->entries) + sizeof(*idx->files))) ||
+	    (vars > idx->size / sizeof(*idx->variables)))
+		return 0;
+	strings = sizeof(*head) + (size_t)(head->index.names) * sizeof(*idx->names);
+	strings += (size_t)entries * (sizeof(*idx->entries) + sizeof(*idx->files));
+	strings += (size_t)vars * sizeof(*idx->variables);
+	if ((strings >= idx->size) || idx->data[idx->size - 1])
+		return 0;
+
+	idx->names = (struct index_name *)(idx->data + sizeof(*head));
+	idx->entries = (uint64_t *)(idx->names + head->index.names);
+	idx->files = (struct db_file *)(idx->entries + entries);
+	idx->variables = (struct db_variable *)(idx->files + entries);
+	for (i = 0; i < head->index.names; i++)
+		if ((idx->names[i].name < strings) || (idx->names[i].name >= idx->size) ||
+		    (idx->names[i].first > entries) || (idx->names[i].count > entries - idx->names[i].first))
+			return 0;
+	for (i = 0; i < entries; i++)
+		if ((idx->entries[i] < strings) || (idx->entries[i] >= idx->size) ||
+		    !strchr(idx->data + idx->entries[i], '=') ||
+		    (idx->files[i].first > vars) || (idx->files[i].count > vars - idx->files[i].first) ||
+		    (idx->files[i].dir >= head->dirs))
+			return 0;
+	for (i = 0; i < vars; i++) {
+		var = idx->variables + i;
+		if ((var->name < strings) || (var->name > idx->size) || (var->name_len > idx->size - var->name) ||
+		    (var->value < strings) || (var->value > idx->size) || (var->value_len > idx->size - var->value))
+			return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * Read the rest of a file into memory.
+ * 
+ * @param   fd    The file descriptor of the file.
+ * @param   size  Output parameter for the number of read bytes.
+ * @return        The read data, `NULL` on error.
+ */
+static char *read_fd(int fd, size_t *size)
+{
+	char *data = NULL;
+	size_t alloc = 0;
+	ssize_t n;
+
+	for (*size = 0;;) {
+		MAYBE_GROW(data, *size, alloc, 512);
+		n = read(fd, data + *size, alloc - *size);
+		t (n < 0);
+		if (n == 0)
+			break;
+		*size += (size_t)n;
+	}
+	COUNT(bytes_read, *size);
+	return data;
+
+fail:
+	RETURN (NULL)
+	free(data);
+}
+
+
+/**
+ * Load a database file.
+ * 
+ * @param   ctx  The context.
+ * @param   idx  Output parameter for the database, `idx->path` must be set.
+ * @param   st   The status of the file.
+ * @return       0 on success, -1 on error.
+ */
+static int load_database(const struct librarian *ctx, struct dir_index *idx, const struct stat *st)
+{
+	int fd;
+	void *map;
+
+	if ((size_t)(st->st_size) < sizeof(struct db_header)) {
+		errno = EBADMSG;
+		return -1;
+	}
+	fd = open(idx->path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	COUNT(files_opened, 1);
+	if (ctx->copy_files) {
+		idx->data = read_fd(fd, &idx->size);
+		close(fd);
+		if (idx->data == NULL)
+			return -1;
+		idx->mapped = 0;
+	} else {
+		map = mmap(NULL, (size_t)(st->st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			return -1;
+		COUNT(bytes_read, st->st_size);
+		idx->data = map;
+		idx->size = (size_t)(st->st_size);
+		idx->mapped = 1;
+	}
+
+	if (check_database(idx))
+		return 0;
+	if (idx->mapped)
+		munmap(idx->data, idx->size);
+	else
+		free(idx->data);
+	idx->data = NULL;
+	errno = EBADMSG;
+	return -1;
+}
+
+
+/**
+ * Load the index of a directory from its index
+ * file, or create it if the index file is missing
+ * or out of date. If `path` is a regular file, it
+ * is loaded as a database instead. Unlike get_index(),
+ * this function does not touch `ctx->indices` and may
+ * be called from multiple threads at once.
+ * 
+ * @param   ctx   The context.
+ * @param   idx   Output parameter for the index.
+ * @param   path  The pathname of the directory or database.
+ * @return        0 on success, -1 on error.
+ */
+static int open_index(const struct librarian *ctx, struct dir_index *idx, const char *path)
+{
+	struct stat st;
+	int r;
+
+	memset(idx, 0, sizeof(*idx));
+	t (stat(path, &st));
+	idx->path = counted_strdup(path);
+	t (idx->path == NULL);
+
+	if (S_ISREG(st.st_mode)) {
+		t (load_database(ctx, idx, &st));
+		return 0;
+	}
+
+	r = ctx->index_dir ? load_index(ctx, idx, &st) : 0;
+	t (r < 0);
+	if (r == 0) {
+		t (build_index(idx, &st));
+		if ((ctx->index_dir != NULL) && !racy_index(&st, time(NULL)))
+			save_index(ctx, idx);
+	}
+	return 0;
+
+fail:
+	free(idx->path);
+	idx->path = NULL;
+	return -1;
+}
+
+
+/**
+ * Look up the index of a directory among
+ * the already loaded indices.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the directory.
+ * @return        The index, `NULL` if not loaded.
+ */
+static struct dir_index *find_index(struct librarian *ctx, const char *path)
+{
+	size_t i;
+
+	for (i = 0; i < ctx->indices_count; i++)
+		if (!strcmp(ctx->indices[i].path, path))
+			return ctx->indices + i;
+	return NULL;
+}
+
+
+/**
+ * Get the index of a directory, loading it from
+ * its index file, or creating it if the index
+ * file is missing or out of date.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the directory.
+ * @return        The index, `NULL` on error.
+ */
+static struct dir_index *get_index(struct librarian *ctx, const char *path)
+{
+	struct dir_index *idx = find_index(ctx, path);
+
+	if (idx != NULL)
+		return idx;
+
+	if (ctx->watch_directory != NULL)
+		t (ctx->watch_directory(ctx->watch_data, path));
+	REALLOC(ctx->indices, ctx->indices_count + 1);
+	idx = ctx->indices + ctx->indices_count;
+	t (open_index(ctx, idx, path));
+
+	ctx->indices_count++;
+	return idx;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Release a loaded index.
+ * 
+ * @param  idx  The index.
+ */
+static void free_index(struct dir_index *idx)
+{
+	struct index_header *head = (struct index_header *)(idx->data);
+	size_t i;
+
+	if (idx->keys != NULL)
+		for (i = 0; i < (size_t)(head->entries); i++)
+			free_version_key(idx->keys + i);
+	free(idx->keys);
+	if (idx->mapped)
+		munmap(idx->data, idx->size);
+	else if (!idx->borrowed)
+		free(idx->data);
+	free(idx->path);
+}
+
+
+/**
+ * Test whether a pathname is a directory that is served
+ * from an embedded database, or a file in such directory.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname.
+ * @param   len   The length of `path`.
+ * @return        1 if the pathname is embedded, 0 otherwise.
+ */
+static int embedded(const struct librarian *ctx, const char *path, size_t len)
+{
+	size_t i, n;
+
+	for (i = 0; i < ctx->indices_count; i++) {
+		if (!ctx->indices[i].borrowed)
+			continue;
+		n = strlen(ctx->indices[i].path);
+		if ((n > len) || strncmp(ctx->indices[i].path, path, n))
+			continue;
+		if ((n == len) || ((path[n] == '/') && !memchr(path + n + 1, '/', len - n - 1)))
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Test whether a version of a library is compatible
+ * with any of a set of version ranges.
+ * 
+ * @param   version   The found version.
+ * @param   required  Compatible version ranges.
+ * @param   n         The number of elements in `required`.
+ * @return            1: Version is accepted.
+ *                    0: Version is incompatible.
+ */
+static int test_library_versions(const struct version_key *version, const struct library *required, size_t n)
+{
+	while (n--)
+		if (test_library_version(version, required++))
+			return 1;
+	return 0;
+}
+
+
+/**
+ * Get the number of consecutive library
+ * specifications with the same name.
+ * 
+ * @param   libs  The library specifications.
+ * @param   n     The number of elements in `libs`.
+ * @return        The number of specifications, from the first, with the
+ *                same name as the first specification, at least 1.
+ */
+static size_t library_group(const struct library *libs, size_t n)
+{
+	size_t i;
+	for (i = 1; i < n; i++)
+		if (strcmp(libs[i].name, libs->name))
+			break;
+	return i;
+}
+
+
+/**
+ * Replace a pathname of a librarian file with another,
+ * if the other one has a more preferred version.
+ * 
+ * The version keys are built when first compared, and
+ * move with the pathnames, so that no key is built twice.
+ * 
+ * @param   best       The currently best pathname, `NULL` if none.
+ * @param   best_key   The version key of `*best`, unbuilt (zeroed)
+ *                     until needed, shall be released with
+ *                     free_version_key().
+ * @param   candidate  The other pathname, will be freed if not used.
+ * @param   cand_key   The version key of `candidate`, `NULL` or unbuilt
+ *                     if not known. It is taken over, and left unbuilt.
+ * @param   oldest     Are older versions prefered?
+ * @return             0 on success, -1 on error.
+ */
+static int update_best(char **best, struct version_key *best_key, char *candidate,
+                       struct version_key *cand_key, int oldest)
+{
+	struct version_key key;
+	char *ver;
+	int r;
+
+	if (cand_key == NULL) {
+		key.heap = NULL;
+		key.count = 0;
+		cand_key = &key;
+	}
+
+	if (*best != NULL) {
+		if (!best_key->count) {
+			GET_VERSION(ver, *best);
+			t (make_version_key(best_key, ver + 1));
+		}
+		if (!cand_key->count) {
+			GET_VERSION(ver, candidate);
+			t (make_version_key(cand_key, ver + 1));
+		}
+		r = version_key_cmp(cand_key, best_key);
+		if (!(oldest ? (r < 0) : (r > 0))) {
+			free_version_key(cand_key);
+			free(candidate);
+			return 0;
+		}
+		free_version_key(best_key);
+	}
+	free(*best);
+	*best = candidate;
+	*best_key = *cand_key;
+	cand_key->heap = NULL;
+	cand_key->count = 0;
+	return 0;
+
+fail:
+	free_version_key(cand_key);
+	free(candidate);
+	return -1;
+}
+
+
+/**
+ * Look up a library name in an index.
+ * 
+ * @param   idx   The index.
+ * @param   name  The name of the library.
+ * @return        The library's entry, `NULL` if the
+ *                directory has no such library.
+ */
+static struct index_name *find_index_name(struct dir_index *idx, const char *name)
+{
+	struct index_header *head = (struct index_header *)(idx->data);
+	size_t lo = 0, hi = (size_t)(head->names), mid;
+	int r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		r = strcmp(name, idx->data + idx->names[mid].name);
+		if (r < 0)
+			hi = mid;
+		else if (r > 0)
+			lo = mid + 1;
+		else
+			return idx->names + mid;
+	}
+	return NULL;
+}
+
+
+/**
+ * Get the version of a librarian file in an index.
+ * 
+ * @param   idx  The index.
+ * @param   i    The index of the file in `idx->entries`.
+ * @return       The version as a version key, `NULL` on error.
+ */
+static const struct version_key *entry_key(struct dir_index *idx, size_t i)
+{
+	struct index_header *head = (struct index_header *)(idx->data);
+	char *ver;
+
+	if (idx->keys == NULL) {
+		idx->keys = counted_calloc((size_t)(head->entries) + 1, sizeof(*idx->keys));
+		if (idx->keys == NULL)
+			return NULL;
+	}
+	if (!idx->keys[i].count) {
+		GET_VERSION(ver, idx->data + idx->entries[i]);
+		if (make_version_key(idx->keys + i, ver + 1))
+			return NULL;
+	}
+	return idx->keys + i;
+}
+
+
+/**
+ * Get the number of directories an index covers.
+ * 
+ * @param   idx  The index.
+ * @return       The number of directories the database was
+ *               compiled from, 1 if `idx` is not a database.
+ */
+static size_t index_dirs(const struct dir_index *idx)
+{
+	return idx->files ? (size_t)(((struct db_header *)(idx->data))->dirs) : 1;
+}
+
+
+/**
+ * Get the directory a librarian file in an index was found in.
+ * 
+ * @param   idx  The index.
+ * @param   i    The index of the file in `idx->entries`.
+ * @return       The index of the directory, of those the database
+ *               was compiled from, 0 if `idx` is not a database.
+ */
+static size_t entry_dir(const struct dir_index *idx, size_t i)
+{
+	return idx->files ? (size_t)(idx->files[i].dir) : 0;
+}
+
+
+/**
+ * Locate a librarian file in an indexed directory.
+ * 
+ * A library's files are sorted by version in the index,
+ * so the files in a version range are consecutive, and
+ * the newest or oldest of them is found with a binary
+ * search for the end of the range, and a test of the
+ * file there against the other end of the range. Files
+ * with the same version are sorted by directory, in a
+ * database, and the earliest directory is preferred.
+ * 
+ * @param   libs    Library specifications, all for the same library.
+ * @param   n       The number of elements in `libs`.
+ * @param   idx     The index of the directory.
+ * @param   oldest  Are older versions prefered?
+ * @return          The pathname of the library's librarian file.
+ *                  `NULL` on error or if not found, if not found,
+ *                  `errno` is set to 0.
+ */
+static char *locate_in_index(struct library *libs, size_t n, struct dir_index *idx, int oldest)
+{
+	struct index_name *name = find_index_name(idx, libs->name);
+	const struct version_key *key;
+	const struct version_key *next;
+	size_t lo, hi, mid, j, dir, best = SIZE_MAX;
+	char *file;
+	char *p;
+
+	if (name == NULL)
+		return errno = 0, NULL;
+
+	for (j = 0; j < n; j++) {
+		/* Find the first file that is not too old, or the first that is too new. */
+		for (lo = 0, hi = (size_t)(name->count); lo < hi;) {
+			mid = lo + (hi - lo) / 2;
+			key = entry_key(idx, (size_t)(name->first) + mid);
+			if (key == NULL)
+				return NULL;
+			if (oldest ? !test_lower_bound(key, libs + j) : test_upper_bound(key, libs + j))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (oldest ? (lo == name->count) : !lo)
+			continue;
+		lo -= !oldest;
+		key = entry_key(idx, (size_t)(name->first) + lo);
+		if (key == NULL)
+			return NULL;
+		if (oldest ? !test_upper_bound(key, libs + j) : !test_lower_bound(key, libs + j))
+			continue;
+		for (; !oldest && idx->files && lo; lo--) {
+			next = entry_key(idx, (size_t)(name->first) + lo - 1);
+			if (next == NULL)
+				return NULL;
+			if (version_key_cmp(next, key))
+				break;
+		}
+		dir = entry_dir(idx, (size_t)(name->first) + lo);
+		for (; !oldest && idx->files && lo + 1 < name->count; lo++) {
+			if (entry_dir(idx, (size_t)(name->first) + lo + 1) != dir)
+				break;
+			next = entry_key(idx, (size_t)(name->first) + lo + 1);
+			if (next == NULL)
+				return NULL;
+			if (version_key_cmp(next, key))
+				break;
+		}
+		if ((best == SIZE_MAX) || (oldest ? (lo < best) : (lo > best)))
+			best = lo;
+	}
+	if (best == SIZE_MAX)
+		return errno = 0, NULL;
+
+	file = idx->data + idx->entries[name->first + best];
+	p = counted_malloc(strlen(idx->path) + strlen(file) + 2);
+	if (p != NULL)
+		stpcpy(stpcpy(stpcpy(p, idx->path), "/"), file);
+	return p;
+}
+
+
+/**
+ * Locate librarian files in a directory, for multiple
+ * libraries, reading the directory once, without using
+ * an index. May be called from multiple threads at once.
+ * 
+ * @param   libs    Library specifications, sorted by name.
+ * @param   n       The number of elements in `libs`.
+ * @param   path    The pathname of the directory.
+ * @param   oldest  Are older versions prefered?
+ * @param   found   For each library, the pathname of its librarian file,
+ *                  stored at the index of the library's first specification
+ *                  in `libs`. Already set pathnames are only replaced by
+ *                  pathnames with more preferred versions.
+ * @param   keys    The version keys of the pathnames in `found`.
+ * @return          0 on success, -1 on error. `errno` is set to
+ *                  `ENOTDIR`, and `found` is unmodified, if `path`
+ *                  is not a directory.
+ */
+static int search_dir(struct library *libs, size_t n, char *path, int oldest, char **found, struct version_key *keys)
+{
+	DIR *d = NULL;
+	struct dirent *f;
+	char *p;
+	char *new;
+	char **best = NULL;
+	struct version_key *best_keys = NULL;
+	struct version_key key;
+	char *best_ver;
+	size_t *best_lens = NULL;
+	size_t *table = NULL;
+	size_t i, g, len, mask = 1, prefix = strlen(path) + 1;
+	int r;
+
+	d = opendir(path);
+	t (d == NULL);
+	COUNT(dirs_opened, 1);
+
+	/* Create a hash table of the sought library names. */
+	while (mask < 2 * n)
+		mask <<= 1;
+	table = counted_calloc(mask--, sizeof(*table));
+	t (table == NULL);
+	for (i = 0; i < n; i += library_group(libs + i, n - i)) {
+		for (g = (size_t)hash_string(libs[i].name) & mask; table[g]; g = (g + 1) & mask);
+		table[g] = i + 1;
+	}
+	best = counted_calloc(n, sizeof(*best));
+	t (best == NULL);
+	best_keys = counted_calloc(n, sizeof(*best_keys));
+	t (best_keys == NULL);
+	best_lens = counted_calloc(n, sizeof(*best_lens));
+	t (best_lens == NULL);
+
+	while ((f = (errno = 0, readdir(d)))) {
+		COUNT(dirents, 1);
+		p = strrchr(f->d_name, '=');
+		if (p == NULL)
+			continue;
+		*p = '\0';
+		for (g = (size_t)hash_string(f->d_name) & mask; table[g]; g = (g + 1) & mask)
+			if (!strcmp(f->d_name, libs[table[g] - 1].name))
+				break;
+		*p++ = '=';
+		if (!table[g])
+			continue;
+		i = table[g] - 1;
+		t (make_version_key(&key, p));
+		r = test_library_versions(&key, libs + i, library_group(libs + i, n - i));
+		if (r && best[i] != NULL) {
+			r = version_key_cmp(&key, best_keys + i);
+			r = r ? r : strcmp(f->d_name, best[i] + prefix);
+			r = oldest ? (r < 0) : (r > 0);
+		}
+		free_version_key(&key);
+		if (!r)
+			continue;
+		/* The pathname is built in place, and its buffer reused for better candidates. */
+		free_version_key(best_keys + i);
+		len = strlen(f->d_name);
+		if (best[i] == NULL || best_lens[i] < len) {
+			new = counted_realloc(best[i], prefix + len + 1);
+			t (new == NULL);
+			if (best[i] == NULL)
+				stpcpy(stpcpy(new, path), "/");
+			best[i] = new;
+			best_lens[i] = len;
+		}
+		memcpy(best[i] + prefix, f->d_name, len + 1);
+		GET_VERSION(best_ver, best[i]);
+		t (make_version_key(best_keys + i, best_ver + 1));
+	}
+	t (errno);
+
+	closedir(d), d = NULL;
+
+	for (i = 0; i < n; i++) {
+		if (best[i] == NULL)
+			continue;
+		p = best[i], best[i] = NULL;
+		t (update_best(found + i, keys + i, p, best_keys + i, oldest));
+	}
+
+	free(best_lens);
+	free(best_keys);
+	free(best);
+	free(table);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (best != NULL)
+		for (i = 0; i < n; i++)
+			free(best[i]);
+	if (best_keys != NULL)
+		for (i = 0; i < n; i++)
+			free_version_key(best_keys + i);
+	free(best_lens);
+	free(best_keys);
+	free(best);
+	free(table);
+	if (d != NULL)
+		closedir(d);
+	}
+}
+
+
+/**
+ * Locate librarian files in a directory or database,
+ * for multiple libraries, reading the directory once.
+ * 
+ * @param   ctx     The context.
+ * @param   libs    Library specifications, sorted by name.
+ * @param   n       The number of elements in `libs`.
+ * @param   path    The pathname of the directory or database.
+ * @param   oldest  Are older versions prefered?
+ * @param   found   For each library, the pathname of its librarian file,
+ *                  stored at the index of the library's first specification
+ *                  in `libs`. Already set pathnames are only replaced by
+ *                  pathnames with more preferred versions.
+ * @param   keys    The version keys of the pathnames in `found`.
+ * @return          0 on success, -1 on error.
+ */
+static int locate_in_dir(struct librarian *ctx, struct library *libs, size_t n, char *path, int oldest,
+                         char **found, struct version_key *keys)
+{
+	struct dir_index *idx;
+	size_t i, g;
+	char *p;
+
+	if ((ctx->index_dir == NULL) && !ctx->in_memory_indices && !embedded(ctx, path, strlen(path))) {
+		if (!search_dir(libs, n, path, oldest, found, keys))
+			return 0;
+		t (errno != ENOTDIR);
+	}
+
+	idx = get_index(ctx, path);
+	t (idx == NULL);
+	for (i = 0; i < n; i += g) {
+		g = library_group(libs + i, n - i);
+		p = locate_in_index(libs + i, g, idx, oldest);
+		t (!p && errno);
+		if (p != NULL)
+			t (update_best(found + i, keys + i, p, NULL, oldest));
+	}
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Release a loaded librarian file.
+ * 
+ * @param  file  The content of the file, may be `NULL`.
+ */
+static void free_parsed_file(struct parsed_file *file)
+{
+	if (file != NULL) {
+		if (file->mapped)
+			munmap((void *)(file->data), file->size);
+		else
+			free((void *)(file->data));
+		free(file->vars);
+		free(file->path);
+		free(file);
+	}
+}
+
+
+/**
+ * Create a librarian file without any content.
+ * 
+ * @param   path  The pathname of the file.
+ * @return        The file, `NULL` on error.
+ */
+static struct parsed_file *new_parsed_file(const char *path)
+{
+	struct parsed_file *file = NULL;
+
+	file = counted_calloc(1, sizeof(*file));
+	t (file == NULL);
+	file->path = counted_strdup(path);
+	t (file->path == NULL);
+	file->mask = 15;
+	file->vars = counted_calloc(file->mask + 1, sizeof(*file->vars));
+	t (file->vars == NULL);
+	return file;
+
+fail:
+	RETURN (NULL)
+	free_parsed_file(file);
+}
+
+
+/**
+ * Load the content of an opened librarian file. The
+ * file is mapped into memory when possible, unless
+ * `ctx->copy_files` is set, and its variables are
+ * indexed on demand by `find_variable`.
+ * 
+ * @param   ctx      The context.
+ * @param   file     The file, `file->data` and `file->size` are set.
+ * @param   fd       The file descriptor of the file, not closed.
+ * @param   regular  Is the file a regular file?
+ * @param   size     The size of the file, if it is a regular file.
+ * @return           0 on success, -1 on error.
+ */
+static int load_fd(const struct librarian *ctx, struct parsed_file *file, int fd, int regular, size_t size)
+{
+	void *map;
+
+	if (regular && size && !ctx->copy_files) {
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			file->data = map;
+			file->size = size;
+			file->mapped = 1;
+			COUNT(bytes_read, size);
+			return 0;
+		}
+	}
+
+	file->data = read_fd(fd, &file->size);
+	return file->data ? 0 : -1;
+}
+
+
+/**
+ * Load a librarian file.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the file to load.
+ * @return        The content of the file, `NULL` on error.
+ */
+static struct parsed_file *load_file(const struct librarian *ctx, const char *path)
+{
+	int fd = -1;
+	struct parsed_file *file = NULL;
+	struct stat st;
+
+	file = new_parsed_file(path);
+	t (file == NULL);
+
+	fd = open(path, O_RDONLY);
+	t (fd == -1);
+	COUNT(files_opened, 1);
+	t (fstat(fd, &st));
+	t (load_fd(ctx, file, fd, S_ISREG(st.st_mode), (size_t)(st.st_size)));
+
+	close(fd);
+	return file;
+
+fail:
+	RETURN (NULL) {
+	if (fd >= 0)
+		close(fd);
+	free_parsed_file(file);
+	}
+}
+
+
+/**
+ * Ask the kernel to start reading a librarian file,
+ * so that it is cached when it is loaded. Errors are
+ * ignored, they are reported when the file is loaded.
+ * 
+ * @param  path  The pathname of the file.
+ */
+static void prefetch_file(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+}
+
+
+/**
+ * Split LIBRARIAN_PATH into its non-empty
+ * entries, by replacing the colons with NUL.
+ * 
+ * @param   path   LIBRARIAN_PATH, restore it with restore_path().
+ * @param   dirs   Output parameter for the entries.
+ * @param   count  Output parameter for the number of entries.
+ * @return         0 on success, -1 on error.
+ */
+static int split_path(char *path, char ***dirs, size_t *count)
+{
+	size_t size = 0;
+	char *p;
+	char *end;
+
+	*dirs = NULL;
+	*count = 0;
+	for (p = path; p; p = end ? (end + 1) : NULL) {
+		if ((end = strchr(p, ':')))
+			*end = '\0';
+		if (!*p)
+			continue;
+		MAYBE_GROW(*dirs, *count, size, 8);
+		(*dirs)[(*count)++] = p;
+	}
+	return 0;
+
+fail:
+	free(*dirs);
+	*dirs = NULL;
+	return -1;
+}
+
+
+/**
+ * Undo split_path().
+ * 
+ * @param  path  LIBRARIAN_PATH.
+ * @param  len   The length of LIBRARIAN_PATH.
+ */
+static void restore_path(char *path, size_t len)
+{
+	while (len--)
+		if (!path[len])
+			path[len] = ':';
+}
+
+
+/**
+ * Scan directories until there are none left.
+ * 
+ * @param   arg:struct scan *  The work.
+ * @return                     `NULL`.
+ */
+static void *scan_worker(void *arg)
+{
+	struct scan *s = arg;
+	size_t i, j;
+	int r;
+
+	enter(s->ctx);
+	for (;;) {
+		pthread_mutex_lock(&s->lock);
+		i = s->next++;
+		pthread_mutex_unlock(&s->lock);
+		if (i >= s->dirs_count)
+			break;
+		if (s->parsed != NULL)
+			r = -!(s->parsed[i] = load_file(s->ctx, s->dirs[i]));
+		else if (s->found != NULL && embedded(s->ctx, s->dirs[i], strlen(s->dirs[i])))
+			r = -1, errno = ENOTDIR;
+		else if (s->found != NULL)
+			r = search_dir(s->libs, s->n, s->dirs[i], s->oldest, s->found + i * s->n, s->found_keys + i * s->n);
+		else
+			r = open_index(s->ctx, s->loaded + i, s->dirs[i]);
+		s->errors[i] = r ? (errno ? errno : EIO) : 0;
+		/* Read the files while the other directories are searched. */
+		for (j = 0; !r && s->found && s->ctx->prefetch && j < s->n; j++)
+			if (s->found[i * s->n + j] != NULL)
+				prefetch_file(s->found[i * s->n + j]);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Scan directories with up to `s->ctx->jobs`
+ * threads, including the calling thread.
+ * 
+ * @param  s  The work, `next` and `lock`
+ *            need not be initialised.
+ */
+static void run_scan(struct scan *s)
+{
+	size_t jobs = (size_t)(s->ctx->jobs);
+	pthread_t *threads;
+	size_t i = 0, n = s->dirs_count < jobs ? s->dirs_count : jobs;
+
+	s->next = 0;
+	pthread_mutex_init(&s->lock, NULL);
+	threads = n > 1 ? counted_malloc((n - 1) * sizeof(*threads)) : NULL;
+	for (; threads && i < n - 1; i++)
+		if (pthread_create(threads + i, NULL, scan_worker, s))
+			break;
+	scan_worker(s);
+	while (i--)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&s->lock);
+}
+
+
+/**
+ * Load the indices of directories, that are not
+ * already loaded, in parallel. Errors are ignored,
+ * they will be detected by get_index() later.
+ * 
+ * @param  ctx    The context.
+ * @param  dirs   The directories.
+ * @param  count  The number of elements in `dirs`.
+ */
+static void preload_indices(struct librarian *ctx, char **dirs, size_t count)
+{
+	struct scan s;
+	struct dir_index *new;
+	size_t i, m = 0;
+
+	memset(&s, 0, sizeof(s));
+	s.ctx = ctx;
+	s.dirs = counted_malloc(count * sizeof(*s.dirs));
+	s.loaded = counted_calloc(count, sizeof(*s.loaded));
+	s.errors = counted_calloc(count, sizeof(*s.errors));
+	if (!s.dirs || !s.loaded || !s.errors)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		if (find_index(ctx, dirs[i]))
+			continue;
+		if (ctx->watch_directory != NULL && ctx->watch_directory(ctx->watch_data, dirs[i]))
+			continue;
+		s.dirs[m++] = dirs[i];
+	}
+	if (m < 2)
+		goto out;
+	s.dirs_count = m;
+	run_scan(&s);
+
+	for (i = 0; i < m; i++) {
+		if (s.errors[i])
+			continue;
+		if (find_index(ctx, s.dirs[i]) == NULL) {
+			new = counted_realloc(ctx->indices, (ctx->indices_count + 1) * sizeof(*ctx->indices));
+			if (new != NULL) {
+				ctx->indices = new;
+				ctx->indices[ctx->indices_count++] = s.loaded[i];
+				continue;
+			}
+		}
+		free_index(s.loaded + i);
+	}
+
+out:
+	free(s.dirs);
+	free(s.loaded);
+	free(s.errors);
+}
+
+
+/**
+ * Locate librarian files on the system.
+ * 
+ * @param   ctx     The context.
+ * @param   libs    Library specifications, sorted by name.
+ * @param   n       The number of elements in `libs`.
+ * @param   path    LIBRARIAN_PATH.
+ * @param   oldest  Are older versions prefered?
+ * @param   found   For each library, the pathname of its librarian file,
+ *                  stored at the index of the library's first specification
+ *                  in `libs`. Shall be initialised with `NULL`:s. `NULL`
+ *                  remains for libraries that were not found.
+ * @param   keys    The version keys of the pathnames in `found`, shall
+ *                  be zero-initialised, and released by the caller.
+ * @return          0 on success, -1 on error.
+ */
+static int locate(struct librarian *ctx, struct library *libs, size_t n, char *path, int oldest,
+                  char **found, struct version_key *keys)
+{
+	size_t len = strlen(path), count = 0, i, j;
+	char **dirs = NULL;
+	char *p;
+	struct scan s;
+
+	memset(&s, 0, sizeof(s));
+	t (split_path(path, &dirs, &count));
+
+	if (ctx->jobs > 1 && count > 1) {
+		if ((ctx->index_dir != NULL) || ctx->in_memory_indices) {
+			/* Read the indices in parallel, and search them below. */
+			preload_indices(ctx, dirs, count);
+		} else {
+			/* Search the directories in parallel, and merge them in order. */
+			s.ctx = ctx;
+			s.libs = libs;
+			s.n = n;
+			s.oldest = oldest;
+			s.dirs = dirs;
+			s.dirs_count = count;
+			s.found = counted_calloc(count * n + 1, sizeof(*s.found));
+			t (s.found == NULL);
+			s.found_keys = counted_calloc(count * n + 1, sizeof(*s.found_keys));
+			t (s.found_keys == NULL);
+			s.errors = counted_calloc(count, sizeof(*s.errors));
+			t (s.errors == NULL);
+			run_scan(&s);
+			for (i = 0; i < count; i++) {
+				if (s.errors[i] == ENOTDIR) {
+					/* Databases, including embedded ones, are searched here, as they are kept in `ctx->indices`. */
+					t (locate_in_dir(ctx, libs, n, dirs[i], oldest, found, keys));
+					continue;
+				}
+				if (s.errors[i]) {
+					errno = s.errors[i];
+					goto fail;
+				}
+				for (j = 0; j < n; j++) {
+					p = s.found[i * n + j];
+					s.found[i * n + j] = NULL;
+					if (p != NULL)
+						t (update_best(found + j, keys + j, p, s.found_keys + i * n + j, oldest));
+				}
+			}
+			goto done;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		t (locate_in_dir(ctx, libs, n, dirs[i], oldest, found, keys));
+
+done:
+	restore_path(path, len);
+	free(s.found_keys);
+	free(s.found);
+	free(s.errors);
+	free(dirs);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	restore_path(path, len);
+	if (s.found != NULL)
+		for (i = 0; i < count * n; i++)
+			free(s.found[i]);
+	if (s.found_keys != NULL)
+		for (i = 0; i < count * n; i++)
+			free_version_key(s.found_keys + i);
+	free(s.found_keys);
+	free(s.found);
+	free(s.errors);
+	free(dirs);
+	}
+}
+
+
+/**
+ * Record that a library could not be found,
+ * for librarian_missing().
+ * 
+ * @param   ctx  The context.
+ * @param   lib  The library.
+ * @return       0 on success, -1 on error.
+ */
+static int set_missing(struct librarian *ctx, const struct library *lib)
+{
+	size_t len = strlen(lib->name) + 5;
+
+	len += lib->lower ? strlen(lib->lower) : 0;
+	len += lib->upper ? strlen(lib->upper) : 0;
+	free(ctx->missing);
+	ctx->missing = counted_malloc(len);
+	if (ctx->missing == NULL)
+		return -1;
+
+	if (lib->upper == lib->lower) {
+		sprintf(ctx->missing, "%s%s%s",
+			lib->name, lib->upper ? "=" : "",
+			lib->upper ? lib->upper : "");
+	} else {
+		sprintf(ctx->missing, "%s%s%s%s%s%s%s",
+			lib->name,
+			lib->lower ? ">" : "", lib->lower_closed ? "=" : "",
+			lib->lower ? lib->lower : "",
+			lib->upper ? "<" : "", lib->upper_closed ? "=" : "",
+			lib->upper ? lib->upper : "");
+	}
+	return 0;
+}
+
+
+/**
+ * Get an already located librarian file.
+ * 
+ * @param   ctx   The context.
+ * @param   name  The name of the library.
+ * @return        The file, `NULL` if not located.
+ */
+static struct found_file *find_found_file(const struct librarian *ctx, const char *name)
+{
+	size_t h, i;
+
+	if (ctx->found_map != NULL) {
+		h = (size_t)hash_string(name) & ctx->found_map_mask;
+		for (; (i = ctx->found_map[h]); h = (h + 1) & ctx->found_map_mask)
+			if (!strcmp(ctx->found_files[i - 1].name, name))
+				return ctx->found_files + i - 1;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Add a located librarian file to `ctx->found_map`.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file in `ctx->found_files`,
+ *               all files before it must already be added.
+ * @return       0 on success, -1 on error.
+ */
+static int add_found_file(struct librarian *ctx, size_t i)
+{
+	size_t *map = ctx->found_map;
+	size_t *table;
+	size_t h, j, mask;
+
+	if (2 * (i + 1) > ctx->found_map_mask + 1) {
+		mask = ctx->found_map_mask ? (2 * ctx->found_map_mask + 1) : 63;
+		table = counted_calloc(mask + 1, sizeof(*table));
+		t (table == NULL);
+		for (j = 0; map && (j <= ctx->found_map_mask); j++) {
+			if (!map[j])
+				continue;
+			h = (size_t)hash_string(ctx->found_files[map[j] - 1].name) & mask;
+			for (; table[h]; h = (h + 1) & mask);
+			table[h] = map[j];
+		}
+		free(map);
+		ctx->found_map = map = table;
+		ctx->found_map_mask = mask;
+	}
+
+	h = (size_t)hash_string(ctx->found_files[i].name) & ctx->found_map_mask;
+	for (; map[h]; h = (h + 1) & ctx->found_map_mask);
+	map[h] = i + 1;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Find librarian files for all libraries.
+ * 
+ * Found files are appended to `ctx->found_files`, and
+ * libraries that already have been found are only checked
+ * against the found version, so each round only visits
+ * the libraries that were added since the last round.
+ * 
+ * @param   ctx        The context.
+ * @param   libraries  The sought libraries.
+ * @param   n          The number of elements in `libraries`.
+ * @param   path       LIBRARIAN_PATH.
+ * @param   oldest     Are older versions prefered?
+ * @param   missing    Output parameter for the library that
+ *                     was not found, if any.
+ * @return             0:             Successful and found all files.
+ *                     -1 and !errno: Did not find all files, but otherwise successful.
+ *                     -1 and errno:  An error occurred
+ */
+static int find_librarian_files(struct librarian *ctx, struct library *libraries, size_t n, char *path,
+                                int oldest, struct library *missing)
+{
+	size_t i, j, g = 1, h = 1, k = 0, m = 0;
+	char **found = NULL;
+	struct version_key *found_keys = NULL;
+	const char *found_ver;
+	struct library *sought = NULL;
+	struct found_file *found_files;
+	struct found_file *have;
+	struct version_key key;
+	struct version_key *found_key;
+
+	qsort(libraries, n, sizeof(*libraries), library_name_cmp);
+	if (ctx->found_files_size < ctx->found_files_count + n) {
+		ctx->found_files_size = ctx->found_files_count + n;
+		REALLOC(ctx->found_files, ctx->found_files_size);
+	}
+	found_files = ctx->found_files;
+
+	/* Locate all libraries that have not already been found, at once. */
+	sought = counted_malloc((n + !n) * sizeof(*sought));
+	t (sought == NULL);
+	found = counted_calloc(n + !n, sizeof(*found));
+	t (found == NULL);
+	found_keys = counted_calloc(n + !n, sizeof(*found_keys));
+	t (found_keys == NULL);
+	for (i = 0; i < n; i += g) {
+		g = library_group(libraries + i, n - i);
+		if (!find_found_file(ctx, libraries[i].name))
+			for (j = i; j < i + g; j++)
+				sought[m++] = libraries[j];
+	}
+	t (locate(ctx, sought, m, path, oldest, found, found_keys));
+
+	for (i = 0; i < n; i += g) {
+		g = library_group(libraries + i, n - i);
+		have = find_found_file(ctx, libraries[i].name);
+		if (!have && found[k] == NULL) {
+			h = g;
+			goto not_found;
+		}
+		if (have) {
+			found_ver = have->version;
+			found_key = &key;
+		} else {
+			GET_VERSION(found_ver, found[k]);
+			found_ver++;
+			found_key = found_keys + k;
+		}
+		if (have || libraries[i].origin != libraries[i + g - 1].origin) {
+			/* Every origin must accept the version, not just one. */
+			if (have || !found_key->count)
+				t (make_version_key(found_key, found_ver));
+			for (j = i; j < i + g; j += h) {
+				for (h = 1; j + h < i + g && libraries[j + h].origin == libraries[j].origin; h++);
+				if (!test_library_versions(found_key, libraries + j, h))
+					break;
+			}
+			if (have)
+				free_version_key(&key);
+			if (j < i + g) {
+				i = j;
+				goto not_found;
+			}
+		}
+		if (have)
+			continue;
+		memset(found_files + ctx->found_files_count, 0, sizeof(*found_files));
+		found_files[ctx->found_files_count].name = libraries[i].name;
+		found_files[ctx->found_files_count].path = arena_intern(&ctx->arena, found[k], strlen(found[k]));
+		t (found_files[ctx->found_files_count].path == NULL);
+		GET_VERSION(found_files[ctx->found_files_count].version, found_files[ctx->found_files_count].path);
+		found_files[ctx->found_files_count].version++;
+		found_files[ctx->found_files_count].round = ctx->trace.rounds_count - !!ctx->trace.rounds_count;
+		t (add_found_file(ctx, ctx->found_files_count++));
+		free(found[k]), found[k] = NULL;
+		free_version_key(found_keys + k);
+		k += g;
+	}
+
+	free(sought);
+	free(found_keys);
+	free(found);
+	return 0;
+
+not_found:
+	*missing = libraries[i + h - 1];
+	errno = 0;
+fail:
+	RETURN (-1) {
+	if (found != NULL)
+		while (m--)
+			free(found[m]);
+	if (found_keys != NULL)
+		for (i = 0; i < n; i++)
+			free_version_key(found_keys + i);
+	free(found_keys);
+	free(found);
+	free(sought);
+	}
+}
+
+
+/**
+ * Index the next line in a librarian file.
+ * 
+ * @param   file  The content of the file.
+ * @return        The variable on the line, `NULL` on error or if
+ *                the line does not define a new variable, `errno`
+ *                is set to 0 if no new variable was defined.
+ */
+static const struct variable *index_line(struct parsed_file *file)
+{
+	const char *p = file->data + file->scanned;
+	const char *end = file->data + file->size;
+	const char *eol;
+	struct variable var;
+	struct variable *vars;
+	size_t h, i, mask;
+
+	eol = memchr(p, '\n', (size_t)(end - p));
+	eol = eol ? eol : end;
+	file->scanned = (size_t)(eol - file->data) + (eol != end);
+
+	if ((p == eol) || isspace(*p) || (*p == '#'))
+		return errno = 0, NULL;
+	var.name = p;
+	while ((p != eol) && !isspace(*p))
+		p++;
+	var.name_len = (size_t)(p - var.name);
+	var.value = p + (p != eol);
+	var.value_len = (size_t)(eol - var.value);
+
+	if (2 * (file->count + 1) > file->mask + 1) {
+		mask = 2 * file->mask + 1;
+		vars = counted_calloc(mask + 1, sizeof(*vars));
+		t (vars == NULL);
+		for (i = 0; i <= file->mask; i++) {
+			if (file->vars[i].name == NULL)
+				continue;
+			h = (size_t)hash_data(file->vars[i].name, file->vars[i].name_len) & mask;
+			for (; vars[h].name; h = (h + 1) & mask);
+			vars[h] = file->vars[i];
+		}
+		free(file->vars);
+		file->vars = vars;
+		file->mask = mask;
+	}
+
+	h = (size_t)hash_data(var.name, var.name_len) & file->mask;
+	for (; file->vars[h].name; h = (h + 1) & file->mask)
+		if ((file->vars[h].name_len == var.name_len) && !memcmp(file->vars[h].name, var.name, var.name_len))
+			return errno = 0, NULL;
+	file->vars[h] = var;
+	file->count++;
+	return file->vars + h;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Get a variable in a librarian file. The file is
+ * only indexed up to the line defining the variable.
+ * 
+ * @param   file  The content of the file.
+ * @param   var   The variable to retrieve.
+ * @return        The variable, `NULL` on error or if not
+ *                found, `errno` is set to 0 if not found.
+ */
+static const struct variable *find_variable(struct parsed_file *file, const char *var)
+{
+	size_t len = strlen(var);
+	size_t h = (size_t)hash_data(var, len) & file->mask;
+	const struct variable *found;
+
+	for (; file->vars[h].name; h = (h + 1) & file->mask)
+		if ((file->vars[h].name_len == len) && !memcmp(file->vars[h].name, var, len))
+			return file->vars + h;
+
+	while (file->scanned < file->size) {
+		found = index_line(file);
+		t (!found && errno);
+		if (found && (found->name_len == len) && !memcmp(found->name, var, len))
+			return found;
+	}
+
+	return errno = 0, NULL;
+fail:
+	return NULL;
+}
+
+
+/**
+ * Record that the result of the current
+ * query depends on a directory or file.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the directory or file.
+ * @param   len   The length of `path`.
+ * @return        0 on success, -1 on error.
+ */
+static int consult(struct librarian *ctx, const char *path, size_t len)
+{
+	if (embedded(ctx, path, len))
+		return 0;
+	MAYBE_GROW(ctx->consulted, ctx->consulted_count, ctx->consulted_size, 8);
+	ctx->consulted[ctx->consulted_count] = arena_intern(&ctx->arena, path, len);
+	t (ctx->consulted[ctx->consulted_count] == NULL);
+	ctx->consulted_count++;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Record that the result of the current query depends
+ * on a librarian file, unless already recorded.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The file.
+ * @return        0 on success, -1 on error.
+ */
+static int consult_file(struct librarian *ctx, struct parsed_file *file)
+{
+	if (file->consulted == ctx->query)
+		return 0;
+	file->consulted = ctx->query;
+	return consult(ctx, file->path, strlen(file->path));
+}
+
+
+/**
+ * Look up an already loaded librarian file.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the file.
+ * @return        The content of the file, `NULL`
+ *                if it has not been loaded.
+ */
+static struct parsed_file *find_file(const struct librarian *ctx, const char *path)
+{
+	struct parsed_file **files = ctx->files;
+	size_t h;
+
+	if (files != NULL) {
+		h = (size_t)hash_string(path) & ctx->files_mask;
+		for (; files[h]; h = (h + 1) & ctx->files_mask)
+			if (!strcmp(files[h]->path, path))
+				return files[h];
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Add a loaded librarian file to `ctx->files`.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The file, must not already be in `ctx->files`.
+ * @return        0 on success, -1 on error.
+ */
+static int add_file(struct librarian *ctx, struct parsed_file *file)
+{
+	struct parsed_file **files = ctx->files;
+	struct parsed_file **table;
+	size_t h, i, mask;
+
+	if (2 * (ctx->files_count + 1) > ctx->files_mask + 1) {
+		mask = ctx->files_mask ? (2 * ctx->files_mask + 1) : 63;
+		table = counted_calloc(mask + 1, sizeof(*table));
+		t (table == NULL);
+		for (i = 0; files && (i <= ctx->files_mask); i++) {
+			if (files[i] == NULL)
+				continue;
+			h = (size_t)hash_string(files[i]->path) & mask;
+			for (; table[h]; h = (h + 1) & mask);
+			table[h] = files[i];
+		}
+		free(files);
+		ctx->files = files = table;
+		ctx->files_mask = mask;
+	}
+
+	h = (size_t)hash_string(file->path) & ctx->files_mask;
+	for (; files[h]; h = (h + 1) & ctx->files_mask);
+	files[h] = file;
+	ctx->files_count++;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Get the database a librarian file is stored in.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the file.
+ * @param   load  Shall the database be loaded if it has not
+ *                been loaded? If zero, the file is assumed
+ *                to not be in a database unless the
+ *                database has been loaded.
+ * @return        The database, `NULL` on error or if the file is
+ *                not in a database, `errno` is set to 0 in the
+ *                latter case.
+ */
+static struct dir_index *get_database(struct librarian *ctx, const char *path, int load)
+{
+	const char *slash = strrchr(path, '/');
+	struct dir_index *idx = NULL;
+	size_t i, len;
+	char *dir;
+
+	if (slash == NULL)
+		return errno = 0, NULL;
+	len = (size_t)(slash - path);
+
+	if (load) {
+		dir = strndup(path, len);
+		t (dir == NULL);
+		idx = get_index(ctx, dir);
+		free(dir);
+		t (idx == NULL);
+	} else {
+		for (i = 0; i < ctx->indices_count; i++) {
+			if ((ctx->indices[i].files != NULL) && !strncmp(ctx->indices[i].path, path, len) &&
+			    !ctx->indices[i].path[len]) {
+				idx = ctx->indices + i;
+				break;
+			}
+		}
+	}
+
+	if ((idx == NULL) || (idx->files == NULL))
+		return errno = 0, NULL;
+	return idx;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Load a librarian file from a database. The
+ * variables are added to the file at once,
+ * from the variables stored in the database.
+ * 
+ * @param   idx   The database.
+ * @param   path  The pathname of the file.
+ * @return        The content of the file, `NULL` on error.
+ */
+static struct parsed_file *load_database_file(struct dir_index *idx, const char *path)
+{
+	const char *filename = strrchr(path, '/') + 1;
+	struct parsed_file *file = NULL;
+	struct index_name *name;
+	struct db_variable *dbvar;
+	struct variable var;
+	size_t i, n, h, mask = 15;
+	char *lib;
+	char *ver;
+
+	lib = counted_strdup(filename);
+	t (lib == NULL);
+	GET_VERSION(ver, lib);
+	*ver = '\0';
+	name = find_index_name(idx, lib);
+	free(lib);
+	for (i = 0; name && i < name->count; i++)
+		if (!strcmp(idx->data + idx->entries[name->first + i], filename))
+			break;
+	if (!name || i == name->count) {
+		errno = ENOENT;
+		goto fail;
+	}
+	i += (size_t)(name->first);
+
+	file = new_parsed_file(path);
+	t (file == NULL);
+	while (2 * idx->files[i].count > mask + 1)
+		mask = 2 * mask + 1;
+	if (mask != file->mask) {
+		free(file->vars);
+		file->vars = counted_calloc(mask + 1, sizeof(*file->vars));
+		t (file->vars == NULL);
+		file->mask = mask;
+	}
+
+	dbvar = idx->variables + idx->files[i].first;
+	for (n = (size_t)(idx->files[i].count); n--; dbvar++) {
+		var.name = idx->data + dbvar->name;
+		var.name_len = (size_t)(dbvar->name_len);
+		var.value = idx->data + dbvar->value;
+		var.value_len = (size_t)(dbvar->value_len);
+		h = (size_t)hash_data(var.name, var.name_len) & mask;
+		for (; file->vars[h].name; h = (h + 1) & mask);
+		file->vars[h] = var;
+		file->count++;
+	}
+	return file;
+
+fail:
+	RETURN (NULL)
+	free_parsed_file(file);
+}
+
+
+/**
+ * Get a librarian file, loading it unless
+ * it has already been loaded.
+ * 
+ * @param   ctx   The context.
+ * @param   path  The pathname of the file.
+ * @return        The content of the file, `NULL` on error.
+ */
+static struct parsed_file *get_file(struct librarian *ctx, const char *path)
+{
+	struct parsed_file *file = find_file(ctx, path);
+	struct dir_index *idx;
+
+	if (file == NULL) {
+		idx = get_database(ctx, path, 0);
+		file = idx ? load_database_file(idx, path) : load_file(ctx, path);
+		if (!file && !idx && (errno == ENOTDIR)) {
+			idx = get_database(ctx, path, 1);
+			if (idx == NULL && !errno)
+				errno = ENOTDIR;
+			t (idx == NULL);
+			file = load_database_file(idx, path);
+		}
+		t (file == NULL);
+		if (add_file(ctx, file))
+			return free_parsed_file(file), NULL;
+	}
+	return file;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Load the files in `ctx->found_files` that have not
+ * been loaded, all at once. The files are opened and
+ * stat:ed in one batch with io_uring if available, and
+ * then mapped, otherwise the files are loaded by up to
+ * `ctx->jobs` threads. Errors are ignored, files that
+ * cannot be loaded here are loaded by get_file() later,
+ * which reports the error.
+ * 
+ * @param  ctx    The context.
+ * @param  start  The index of the first file.
+ * @param  end    The index after the last file.
+ */
+static void load_files(struct librarian *ctx, size_t start, size_t end)
+{
+	struct found_file *found_files = ctx->found_files;
+	struct file_open *opens = NULL;
+	struct parsed_file *file;
+	struct scan s;
+	size_t i, k, m = 0;
+	double begin = trace_now(ctx), time;
+
+	memset(&s, 0, sizeof(s));
+	s.ctx = ctx;
+	for (i = start; i < end; i++) {
+		if (found_files[i].parsed == NULL)
+			found_files[i].parsed = find_file(ctx, found_files[i].path);
+		if (found_files[i].parsed == NULL && get_database(ctx, found_files[i].path, 0))
+			found_files[i].parsed = get_file(ctx, found_files[i].path);
+		m += found_files[i].parsed == NULL;
+	}
+	if (m < 2)
+		return;
+
+	opens = counted_malloc(m * sizeof(*opens));
+	t (opens == NULL);
+	s.parsed = counted_calloc(m, sizeof(*s.parsed));
+	t (s.parsed == NULL);
+	for (i = start, k = 0; i < end; i++)
+		if (found_files[i].parsed == NULL)
+			opens[k++].path = found_files[i].path;
+
+	if (!librarian__open_files(&ctx->ring, opens, m)) {
+		for (k = 0; k < m; k++) {
+			if (opens[k].fd < 0)
+				continue;
+			COUNT(files_opened, 1);
+			file = new_parsed_file(opens[k].path);
+			if (file != NULL && load_fd(ctx, file, opens[k].fd, 1, opens[k].size)) {
+				free_parsed_file(file);
+				file = NULL;
+			}
+			s.parsed[k] = file;
+			close(opens[k].fd);
+		}
+	} else {
+		if (ctx->jobs < 2)
+			goto fail;
+		s.dirs = counted_malloc(m * sizeof(*s.dirs));
+		t (s.dirs == NULL);
+		s.errors = counted_calloc(m, sizeof(*s.errors));
+		t (s.errors == NULL);
+		for (k = 0; k < m; k++)
+			s.dirs[k] = (char *)(opens[k].path);
+		s.dirs_count = m;
+		run_scan(&s);
+	}
+	/* The batch is shared, so its time is split evenly. */
+	time = (trace_now(ctx) - begin) / (double)m;
+
+	for (i = start, k = 0; i < end; i++) {
+		if (found_files[i].parsed != NULL)
+			continue;
+		found_files[i].load_time += time;
+		file = s.parsed[k++];
+		if (file == NULL)
+			continue;
+		if (add_file(ctx, file))
+			free_parsed_file(file);
+		else
+			found_files[i].parsed = file;
+	}
+
+fail:
+	free(opens);
+	free(s.dirs);
+	free(s.parsed);
+	free(s.errors);
+}
+
+
+/**
+ * Release all loaded librarian files.
+ * 
+ * @param  ctx  The context.
+ */
+static void release_files(struct librarian *ctx)
+{
+	size_t i;
+	for (i = 0; i < ctx->found_files_count; i++)
+		ctx->found_files[i].parsed = NULL;
+	for (i = 0; ctx->files && (i <= ctx->files_mask); i++)
+		free_parsed_file(ctx->files[i]);
+	free(ctx->files);
+	ctx->files = NULL;
+	ctx->files_mask = ctx->files_count = 0;
+}
+
+
+/**
+ * Forget everything that is known about a directory
+ * and the librarian files in it, because it has
+ * been modified.
+ * 
+ * @param  ctx   The context.
+ * @param  path  The pathname of the directory, as it
+ *               appeared in LIBRARIAN_PATH.
+ */
+void librarian_invalidate(struct librarian *ctx, const char *path)
+{
+	struct parsed_file **table = ctx->files;
+	size_t i, h, n = ctx->files_mask + 1, len = strlen(path);
+	const char *p;
+
+	enter(ctx);
+	for (i = 0; i < ctx->indices_count; i++) {
+		if (!strcmp(ctx->indices[i].path, path) && !ctx->indices[i].borrowed) {
+			free_index(ctx->indices + i);
+			ctx->indices[i] = ctx->indices[--ctx->indices_count];
+			break;
+		}
+	}
+
+	if (table == NULL)
+		return;
+	ctx->files = counted_calloc(n, sizeof(*ctx->files));
+	if (ctx->files == NULL) {
+		/* Cannot rehash, so forget everything. */
+		ctx->files = table;
+		release_files(ctx);
+		return;
+	}
+	for (i = 0; i < ctx->found_files_count; i++)
+		ctx->found_files[i].parsed = NULL;
+	for (i = 0; i < n; i++) {
+		if (table[i] == NULL)
+			continue;
+		p = table[i]->path;
+		if (!strncmp(p, path, len) && (p[len] == '/') && !strchr(p + len + 1, '/')) {
+			free_parsed_file(table[i]);
+			ctx->files_count--;
+			continue;
+		}
+		h = (size_t)hash_string(p) & ctx->files_mask;
+		for (; ctx->files[h]; h = (h + 1) & ctx->files_mask);
+		ctx->files[h] = table[i];
+	}
+	free(table);
+}
+
+
+/**
+ * Release all indices and librarian files that have
+ * been loaded, except embedded databases.
+ * 
+ * @param  ctx  The context.
+ */
+void librarian_release_caches(struct librarian *ctx)
+{
+	size_t i, n = 0;
+
+	enter(ctx);
+	for (i = 0; i < ctx->indices_count; i++) {
+		if (ctx->indices[i].borrowed)
+			ctx->indices[n++] = ctx->indices[i];
+		else
+			free_index(ctx->indices + i);
+	}
+	ctx->indices_count = n;
+	if (!n) {
+		free(ctx->indices);
+		ctx->indices = NULL;
+	}
+	release_files(ctx);
+}
+
+
+/**
+ * Compare two candidates, the preferred first,
+ * when newer versions are preferred.
+ * 
+ * @param   a  The first candidate.
+ * @param   b  The second candidate.
+ * @return     Negative if `a` is preferred, positive if `b` is preferred.
+ */
+static int candidate_newest_cmp(const void *a, const void *b)
+{
+	const struct candidate *ca = a;
+	const struct candidate *cb = b;
+	int r = version_key_cmp(&cb->key, &ca->key);
+	if (r)  return r;
+	if (ca->dir != cb->dir)  return ca->dir < cb->dir ? -1 : +1;
+	return (ca->order < cb->order) - (ca->order > cb->order);
+}
+
+
+/**
+ * Compare two candidates, the preferred first,
+ * when older versions are preferred.
+ * 
+ * @param   a  The first candidate.
+ * @param   b  The second candidate.
+ * @return     Negative if `a` is preferred, positive if `b` is preferred.
+ */
+static int candidate_oldest_cmp(const void *a, const void *b)
+{
+	const struct candidate *ca = a;
+	const struct candidate *cb = b;
+	int r = version_key_cmp(&ca->key, &cb->key);
+	if (r)  return r;
+	if (ca->dir != cb->dir)  return ca->dir < cb->dir ? -1 : +1;
+	return (ca->order > cb->order) - (ca->order < cb->order);
+}
+
+
+/**
+ * Get a library known to the dependency resolver,
+ * and make it known if it is not already.
+ * 
+ * @param   r     The resolver.
+ * @param   name  The name of the library, must outlive `r`.
+ * @return        The library, `NULL` on error.
+ */
+static struct package *get_package(struct resolver *r, const char *name)
+{
+	struct package **table = NULL;
+	struct package *pkg;
+	size_t i, j, mask;
+
+	for (i = (size_t)hash_string(name) & r->mask; r->table && (pkg = r->table[i]); i = (i + 1) & r->mask)
+		if (!strcmp(pkg->name, name))
+			return pkg;
+
+	if (r->table == NULL || 2 * (r->count + 1) > r->mask + 1) {
+		mask = r->table ? 2 * r->mask + 1 : 63;
+		table = counted_calloc(mask + 1, sizeof(*table));
+		t (table == NULL);
+		for (j = 0; r->table && j <= r->mask; j++) {
+			if (r->table[j] == NULL)
+				continue;
+			for (i = (size_t)hash_string(r->table[j]->name) & mask; table[i]; i = (i + 1) & mask);
+			table[i] = r->table[j];
+		}
+		free(r->table);
+		r->table = table;
+		r->mask = mask;
+		for (i = (size_t)hash_string(name) & r->mask; r->table[i]; i = (i + 1) & r->mask);
+	}
+
+	pkg = counted_calloc(1, sizeof(*pkg));
+	t (pkg == NULL);
+	pkg->name = name;
+	r->table[i] = pkg;
+	r->count++;
+	return pkg;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Look up all librarian files for a library,
+ * unless that has already been done.
+ * 
+ * @param   r    The resolver.
+ * @param   pkg  The library.
+ * @return       0 on success, -1 on error.
+ */
+static int load_candidates(struct resolver *r, struct package *pkg)
+{
+	struct dir_index *idx;
+	struct index_name *name;
+	struct candidate *c;
+	size_t size = 0, dir = 0, i;
+	char *p;
+	char *e;
+	char *end = r->path;
+	char *file;
+
+	if (pkg->cands != NULL)
+		return 0;
+
+	for (p = r->path; end; *e = (end ? ':' : '\0'), p = end + 1, dir++) {
+		end = strchr(p, ':');
+		e = end ? end : strchr(p, '\0');
+		*e = '\0';
+		if (!*p)
+			continue;
+		idx = get_index(r->ctx, p);
+		if (idx == NULL)
+			goto fail_restore;
+		name = find_index_name(idx, pkg->name);
+		for (i = 0; name && i < name->count; i++) {
+			if (pkg->cands_count == size) {
+				size = size ? size << 1 : 4;
+				c = counted_realloc(pkg->cands, size * sizeof(*c));
+				if (c == NULL)
+					goto fail_restore;
+				pkg->cands = c;
+			}
+			file = idx->data + idx->entries[name->first + i];
+			c = pkg->cands + pkg->cands_count;
+			memset(c, 0, sizeof(*c));
+			c->dir = dir + entry_dir(idx, (size_t)(name->first) + i);
+			c->order = (size_t)(name->first) + i;
+			c->path = arena_alloc(&r->ctx->arena, strlen(p) + strlen(file) + 2);
+			if (c->path == NULL)
+				goto fail_restore;
+			stpcpy(stpcpy(stpcpy(c->path, p), "/"), file);
+			GET_VERSION(c->version, c->path);
+			c->version++;
+			pkg->cands_count++;
+			if (make_version_key(&c->key, c->version))
+				goto fail_restore;
+		}
+		/* The directories a database was compiled from come in their order. */
+		dir += index_dirs(idx) - 1;
+	}
+
+	if (pkg->cands == NULL)
+		REALLOC(pkg->cands, 1);
+	qsort(pkg->cands, pkg->cands_count, sizeof(*pkg->cands),
+	      r->oldest ? candidate_oldest_cmp : candidate_newest_cmp);
+	return 0;
+
+fail_restore:
+	*e = (end ? ':' : '\0');
+fail:
+	return -1;
+}
+
+
+/**
+ * Divide a list of libraries into groups,
+ * one group per library name.
+ * 
+ * @param   r       The resolver.
+ * @param   specs   The libraries, will be sorted by name.
+ * @param   n       The number of elements in `specs`.
+ * @param   groups  Output parameter for the groups.
+ * @param   count   Output parameter for the number of groups.
+ * @return          0 on success, -1 on error.
+ */
+static int make_groups(struct resolver *r, struct library *specs, size_t n,
+                       struct group **groups, size_t *count)
+{
+	size_t i, g;
+
+	qsort(specs, n, sizeof(*specs), library_name_cmp);
+	*count = 0;
+	*groups = counted_malloc((n + !n) * sizeof(**groups));
+	t (*groups == NULL);
+	for (i = 0; i < n; i += g) {
+		g = library_group(specs + i, n - i);
+		(*groups)[*count].specs = specs + i;
+		(*groups)[*count].n = g;
+		(*groups)[*count].accepted = NULL;
+		(*groups)[*count].pkg = get_package(r, specs[i].name);
+		t ((*groups)[(*count)++].pkg == NULL);
+	}
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Load the dependencies of a candidate,
+ * unless that has already been done.
+ * 
+ * @param   r     The resolver.
+ * @param   cand  The candidate.
+ * @return        0 on success, -1 on error.
+ */
+static int load_deps(struct resolver *r, struct candidate *cand)
+{
+	struct parsed_file *file;
+	const struct variable *var;
+	size_t size = 0;
+	char *s;
+	char *end;
+	int k;
+
+	if (cand->deps_state)
+		return 0;
+
+	file = get_file(r->ctx, cand->path);
+	t (file == NULL);
+	t (consult_file(r->ctx, file));
+	var = find_variable(file, "deps");
+	t (!var && errno);
+	cand->deps_string = arena_strndup(&r->ctx->arena, var ? var->value : "", var ? var->value_len : 0);
+	t (cand->deps_string == NULL);
+
+	for (end = s = cand->deps_string; end; s = end + 1) {
+		while (isspace(*s))
+			s++;
+		if ((end = strpbrk(s, " \t\r\n\f\v")))
+			*end = '\0';
+		if (!*s)
+			break;
+		MAYBE_GROW(cand->deps_specs, cand->deps_specs_count, size, 4);
+		k = parse_library(s, cand->deps_specs + cand->deps_specs_count++);
+		t (k < 0);
+		if (k) {
+			cand->deps_state = -1;
+			return 0;
+		}
+	}
+
+	t (make_groups(r, cand->deps_specs, cand->deps_specs_count, &cand->deps, &cand->deps_count));
+	cand->deps_state = 1;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Get which candidates a group accepts.
+ * 
+ * @param   r  The resolver.
+ * @param   g  The group.
+ * @return     For each candidate of the group's library, whether
+ *             it is accepted by the group, `NULL` on error.
+ */
+static unsigned char *group_accepted(struct resolver *r, struct group *g)
+{
+	struct package *pkg = g->pkg;
+	size_t i;
+
+	if (g->accepted != NULL)
+		return g->accepted;
+
+	t (load_candidates(r, pkg));
+	g->accepted = counted_malloc(pkg->cands_count + 1);
+	t (g->accepted == NULL);
+	for (i = 0; i < pkg->cands_count; i++)
+		g->accepted[i] = (unsigned char)test_library_versions(&pkg->cands[i].key, g->specs, g->n);
+	return g->accepted;
+
+fail:
+	return NULL;
+}
+
+
+/**
+ * Put a constraint into effect.
+ * 
+ * @param   r      The resolver.
+ * @param   g      The group that constrains its library.
+ * @param   level  The decision level of the source of the group.
+ * @return         0 on success, -1 on error.
+ */
+static int push_constraint(struct resolver *r, struct group *g, size_t level)
+{
+	struct package *pkg = g->pkg;
+	struct constraint *k;
+	unsigned char *accepted = group_accepted(r, g);
+	unsigned char *allowed = NULL;
+	size_t i, n = 0;
+
+	t (accepted == NULL);
+	allowed = counted_malloc(pkg->cands_count + 1);
+	t (allowed == NULL);
+	for (i = 0; i < pkg->cands_count; i++) {
+		allowed[i] = pkg->cons_count ? (accepted[i] & pkg->cons[pkg->cons_count - 1].allowed[i]) : accepted[i];
+		n += allowed[i];
+	}
+	MAYBE_GROW(pkg->cons, pkg->cons_count, pkg->cons_size, 4);
+	k = pkg->cons + pkg->cons_count++;
+	k->level = level;
+	k->group = g;
+	k->allowed = allowed;
+	k->allowed_count = n;
+	return 0;
+
+fail:
+	free(allowed);
+	return -1;
+}
+
+
+/**
+ * Add a decision level to a library's conflict set.
+ * 
+ * @param   pkg    The library.
+ * @param   level  The decision level.
+ * @return         0 on success, -1 on error.
+ */
+static int add_conflict(struct package *pkg, size_t level)
+{
+	size_t i;
+
+	for (i = 0; i < pkg->conflicts_count; i++)
+		if (pkg->conflicts[i] == level)
+			return 0;
+	MAYBE_GROW(pkg->conflicts, pkg->conflicts_count, pkg->conflicts_size, 4);
+	pkg->conflicts[pkg->conflicts_count++] = level;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Check whether a candidate can be selected, given
+ * the versions selected so far. If not, the decision
+ * levels responsible are added to the library's
+ * conflict set.
+ * 
+ * @param   r    The resolver.
+ * @param   pkg  The library.
+ * @param   c    The index of the candidate.
+ * @return       1 if the candidate can be selected,
+ *               0 if it cannot, -1 on error.
+ */
+static int check_candidate(struct resolver *r, struct package *pkg, size_t c)
+{
+	struct candidate *cand = pkg->cands + c;
+	struct candidate *other;
+	struct nogood *ng;
+	struct group *g;
+	unsigned char *accepted;
+	size_t i, j;
+	int w;
+
+	if (!pkg->cons[pkg->cons_count - 1].allowed[c]) {
+		for (i = 0; pkg->cons[i].group->accepted[c]; i++);
+		t (add_conflict(pkg, pkg->cons[i].level));
+		return 0;
+	}
+
+	t (load_deps(r, cand));
+	if (cand->deps_state < 0)
+		return 0;
+	for (i = 0; i < cand->deps_count; i++) {
+		g = cand->deps + i;
+		if (g->pkg != pkg && !g->pkg->level)
+			continue;
+		accepted = group_accepted(r, g);
+		t (accepted == NULL);
+		if (g->pkg == pkg && !accepted[c])
+			return 0;
+		if (g->pkg != pkg && !accepted[g->pkg->chosen]) {
+			t (add_conflict(pkg, g->pkg->level));
+			return 0;
+		}
+	}
+
+#define MADE(S)  ((S)->pkg == pkg || ((S)->pkg->level && (S)->pkg->chosen == (S)->cand))
+	for (i = 0; i < cand->nogoods_count;) {
+		ng = r->nogoods + cand->nogoods[i];
+		w = ng->sels[ng->watch[0]].pkg != pkg;
+		for (j = 0; j < ng->n; j++)
+			if (j != ng->watch[0] && j != ng->watch[1] && !MADE(ng->sels + j))
+				break;
+		if (j < ng->n) {
+			/* Watch a selection that has not been made instead. */
+			other = ng->sels[j].pkg->cands + ng->sels[j].cand;
+			MAYBE_GROW(other->nogoods, other->nogoods_count, other->nogoods_size, 4);
+			other->nogoods[other->nogoods_count++] = cand->nogoods[i];
+			cand->nogoods[i] = cand->nogoods[--cand->nogoods_count];
+			ng->watch[w] = j;
+			continue;
+		}
+		if (!MADE(ng->sels + ng->watch[!w])) {
+			i++;
+			continue;
+		}
+		for (j = 0; j < ng->n; j++)
+			if (ng->sels[j].pkg != pkg)
+				t (add_conflict(pkg, ng->sels[j].pkg->level));
+		return 0;
+	}
+#undef MADE
+
+	return 1;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Select a version of a library at the next decision level,
+ * and put the dependencies of the version into effect.
+ * 
+ * @param   r    The resolver.
+ * @param   pkg  The library.
+ * @param   c    The index of the selected candidate.
+ * @return       0 on success, -1 on error.
+ */
+static int select_candidate(struct resolver *r, struct package *pkg, size_t c)
+{
+	struct candidate *cand = pkg->cands + c;
+	size_t i;
+
+	if (r->depth + 1 >= r->levels_size)
+		GROW(r->levels, r->levels_size, 16);
+	r->levels[++r->depth] = pkg;
+	pkg->level = r->depth;
+	pkg->chosen = c;
+
+	for (i = 0; i < cand->deps_count; i++) {
+		t (push_constraint(r, cand->deps + i, r->depth));
+		MAYBE_GROW(r->required, r->required_count, r->required_size, 16);
+		r->required[r->required_count].pkg = cand->deps[i].pkg;
+		r->required[r->required_count++].level = r->depth;
+	}
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Undo the selection at the current decision level.
+ * 
+ * @param  r  The resolver.
+ */
+static void unselect_candidate(struct resolver *r)
+{
+	struct package *pkg = r->levels[r->depth];
+	struct candidate *cand = pkg->cands + pkg->chosen;
+	struct package *dep;
+	size_t i;
+
+	for (i = cand->deps_count; i--;) {
+		dep = cand->deps[i].pkg;
+		free(dep->cons[--dep->cons_count].allowed);
+	}
+	while (r->required_count && r->required[r->required_count - 1].level == r->depth)
+		r->required_count--;
+	pkg->level = 0;
+	r->depth--;
+}
+
+
+/**
+ * Record that the selections at the decision levels
+ * in a library's conflict set cannot all be part of
+ * a solution.
+ * 
+ * @param   r    The resolver.
+ * @param   pkg  The library, that has no acceptable candidate.
+ * @return       0 on success, -1 on error.
+ */
+static int learn_nogood(struct resolver *r, struct package *pkg)
+{
+	struct nogood *ng = NULL;
+	struct candidate *cand;
+	struct package *p;
+	size_t i, k;
+
+	MAYBE_GROW(r->nogoods, r->nogoods_count, r->nogoods_size, 16);
+	ng = r->nogoods + r->nogoods_count;
+	ng->n = 0;
+	ng->sels = counted_malloc(pkg->conflicts_count * sizeof(*ng->sels));
+	t (ng->sels == NULL);
+	ng->watch[0] = ng->watch[1] = 0;
+	for (i = 0; i < pkg->conflicts_count; i++) {
+		if (!pkg->conflicts[i])
+			continue;
+		p = r->levels[pkg->conflicts[i]];
+		ng->sels[ng->n].pkg = p;
+		ng->sels[ng->n].cand = p->chosen;
+		/* Watch the latest selections, they are undone first. */
+		if (p->level > ng->sels[ng->watch[0]].pkg->level) {
+			ng->watch[1] = ng->watch[0];
+			ng->watch[0] = ng->n;
+		} else if (ng->watch[1] == ng->watch[0] || p->level > ng->sels[ng->watch[1]].pkg->level) {
+			ng->watch[1] = ng->n;
+		}
+		ng->n++;
+	}
+	for (k = 0; k < 2 && (!k || ng->watch[1] != ng->watch[0]); k++) {
+		cand = ng->sels[ng->watch[k]].pkg->cands + ng->sels[ng->watch[k]].cand;
+		MAYBE_GROW(cand->nogoods, cand->nogoods_count, cand->nogoods_size, 4);
+		cand->nogoods[cand->nogoods_count++] = r->nogoods_count;
+	}
+	r->nogoods_count++;
+	return 0;
+
+fail:
+	if (ng != NULL)
+		free(ng->sels);
+	return -1;
+}
+
+
+/**
+ * Release the dependency resolver.
+ * 
+ * @param  r  The resolver, may be `NULL`.
+ */
+static void free_resolver(struct resolver *r)
+{
+	struct package *pkg;
+	struct candidate *cand;
+	size_t i, j, k;
+
+	if (r == NULL)
+		return;
+	for (i = 0; r->table && i <= r->mask; i++) {
+		if ((pkg = r->table[i]) == NULL)
+			continue;
+		for (j = 0; j < pkg->cands_count; j++) {
+			cand = pkg->cands + j;
+			for (k = 0; k < cand->deps_count; k++)
+				free(cand->deps[k].accepted);
+			for (k = 0; k < cand->deps_specs_count; k++)
+				free_library(cand->deps_specs + k);
+			free_version_key(&cand->key);
+			free(cand->deps);
+			free(cand->deps_specs);
+			free(cand->nogoods);
+		}
+		while (pkg->cons_count)
+			free(pkg->cons[--pkg->cons_count].allowed);
+		free(pkg->cands);
+		free(pkg->cons);
+		free(pkg->conflicts);
+		free(pkg);
+	}
+	for (i = 0; i < r->root_count; i++)
+		free(r->root[i].accepted);
+	for (i = 0; i < r->nogoods_count; i++)
+		free(r->nogoods[i].sels);
+	free(r->root);
+	free(r->table);
+	free(r->levels);
+	free(r->required);
+	free(r->nogoods);
+	free(r);
+}
+
+
+/**
+ * Find a version of each library, and each of their
+ * dependencies, such that all version constraints are
+ * satisfied. Unlike find_librarian_files(), other
+ * versions are tried when the preferred versions
+ * conflict, and the version ranges a library is
+ * required in by different librarian files are
+ * intersected rather than unioned.
+ * 
+ * The search is a depth-first search, that decides the library
+ * with the fewest acceptable versions first, with conflict-directed
+ * backjumping: when no version of a library can be selected,
+ * the search returns directly to the most recent selection
+ * responsible for rejecting the versions, and the responsible
+ * selections are recorded so that the combination is never
+ * tried again.
+ * 
+ * On success, `ctx->found_files` is replaced with the selected
+ * files, in the order the libraries became required.
+ * 
+ * @param   ctx        The context.
+ * @param   libraries  The libraries from the command line, will be sorted.
+ * @param   n          The number of elements in `libraries`.
+ * @param   path       LIBRARIAN_PATH.
+ * @param   oldest     Are older versions prefered?
+ * @param   rp         Output parameter for the resolver, which must be
+ *                     released with free_resolver() after `ctx->found_files`.
+ * @return             0:             Successful and found all files.
+ *                     -1 and !errno: There is no solution, but otherwise successful.
+ *                     -1 and errno:  An error occurred
+ */
+static int resolve(struct librarian *ctx, struct library *libraries, size_t n, char *path, int oldest,
+                   struct resolver **rp)
+{
+	struct resolver *r;
+	struct package *pkg = NULL;
+	struct package *q;
+	struct found_file *f;
+	char **dirs;
+	size_t i, h, len = strlen(path);
+	int k;
+
+	*rp = r = counted_calloc(1, sizeof(*r));
+	t (r == NULL);
+	r->ctx = ctx;
+	r->path = path;
+	r->oldest = oldest;
+
+	/* Index the directories in parallel before they are needed. */
+	if (ctx->jobs > 1 && !split_path(path, &dirs, &i)) {
+		if (i > 1)
+			preload_indices(ctx, dirs, i);
+		restore_path(path, len);
+		free(dirs);
+	}
+
+	t (make_groups(r, libraries, n, &r->root, &r->root_count));
+	r->required = counted_malloc((r->root_count + !r->root_count) * sizeof(*r->required));
+	t (r->required == NULL);
+	r->required_size = r->root_count + !r->root_count;
+	for (i = 0; i < r->root_count; i++) {
+		t (push_constraint(r, r->root + i, 0));
+		r->required[r->required_count].pkg = r->root[i].pkg;
+		r->required[r->required_count++].level = 0;
+	}
+
+	for (;;) {
+		if (pkg == NULL) {
+			/* Decide the most constrained library first. */
+			for (i = 0; i < r->required_count; i++) {
+				q = r->required[i].pkg;
+				if (q->level)
+					continue;
+				if (pkg == NULL || q->cons[q->cons_count - 1].allowed_count <
+				                   pkg->cons[pkg->cons_count - 1].allowed_count)
+					pkg = q;
+			}
+			if (pkg == NULL)
+				break;
+			pkg->next = 0;
+			pkg->conflicts_count = 0;
+		}
+
+		for (k = 0; !k && pkg->next < pkg->cands_count;) {
+			k = check_candidate(r, pkg, pkg->next++);
+			t (k < 0);
+		}
+		if (k) {
+			t (select_candidate(r, pkg, pkg->next - 1));
+			pkg = NULL;
+			continue;
+		}
+
+		/* No version can be selected, jump back to the latest responsible selection. */
+		t (add_conflict(pkg, pkg->cons[0].level));
+		for (h = i = 0; i < pkg->conflicts_count; i++)
+			h = pkg->conflicts[i] > h ? pkg->conflicts[i] : h;
+		if (h == 0)
+			goto not_found;
+		t (learn_nogood(r, pkg));
+		while (r->depth > h) {
+			q = r->levels[r->depth];
+			unselect_candidate(r);
+			q->next = 0;
+			q->conflicts_count = 0;
+		}
+		q = r->levels[h];
+		unselect_candidate(r);
+		for (i = 0; i < pkg->conflicts_count; i++)
+			if (pkg->conflicts[i] != h)
+				t (add_conflict(q, pkg->conflicts[i]));
+		pkg->next = 0;
+		pkg->conflicts_count = 0;
+		pkg = q;
+	}
+
+	ctx->found_files_count = 0;
+	if (ctx->found_files_size < r->depth + 1) {
+		ctx->found_files_size = r->depth + 1;
+		REALLOC(ctx->found_files, ctx->found_files_size);
+	}
+	for (i = 0; i < r->required_count; i++) {
+		pkg = r->required[i].pkg;
+		if (pkg->listed)
+			continue;
+		pkg->listed = 1;
+		f = ctx->found_files + ctx->found_files_count;
+		memset(f, 0, sizeof(*f));
+		f->round = SIZE_MAX;
+		f->name = pkg->name;
+		f->path = pkg->cands[pkg->chosen].path;
+		GET_VERSION(f->version, f->path);
+		f->version++;
+		ctx->found_files_count++;
+	}
+
+	return 0;
+
+not_found:
+	errno = 0;
+fail:
+	return -1;
+}
+
+
+/**
+ * Get variables values stored in librarian files.
+ * 
+ * @param   ctx          The context.
+ * @param   vars         Pointer to the first variable.
+ * @param   vars_end     Pointer to just after the last variable.
+ * @param   files_start  The index of the first file in `ctx->found_files`
+ *                       for which variables should be retrieved.
+ * @param   files_end    The index of the file in `ctx->found_files` after
+ *                       the last file for which variables should be
+ *                       retrieved.
+ * @param   in_arena     Shall the string be allocated in `ctx->arena`,
+ *                       rather than with malloc(3)?
+ * @return               String with all variables, `NULL` on error.
+ */
+static char *get_variables(struct librarian *ctx, const char *const *vars, const char *const *vars_end,
+                           size_t files_start, size_t files_end, int in_arena)
+{
+	struct found_file *file;
+	const char *const *var;
+	const struct variable *part;
+	size_t ptr = 0;
+	size_t len = 0;
+	size_t n;
+	char *rc;
+	char *p;
+	double start;
+
+	load_files(ctx, files_start, files_end);
+
+	while (files_start < files_end) {
+		file = ctx->found_files + files_start++;
+		if (file->parsed == NULL) {
+			start = trace_now(ctx);
+			file->parsed = get_file(ctx, file->path);
+			t (file->parsed == NULL);
+			file->load_time += trace_now(ctx) - start;
+		}
+		t (consult_file(ctx, file->parsed));
+		for (var = vars; var != vars_end; var++) {
+			start = trace_now(ctx);
+			part = find_variable(file->parsed, *var);
+			file->lookup_time += trace_now(ctx) - start;
+			file->lookups++;
+			t (!part && errno);
+			if (!part || !part->value_len)
+				continue;
+			MAYBE_GROW(ctx->parts, ptr, ctx->parts_size, 8);
+			len += part->value_len + 1;
+			ctx->parts[ptr++] = *part;
+		}
+	}
+
+	p = rc = in_arena ? arena_alloc(&ctx->arena, len + !len) : counted_malloc(len + !len);
+	t (rc == NULL);
+	for (n = ptr, ptr = 0; ptr < n; ptr++) {
+		memcpy(p, ctx->parts[ptr].value, ctx->parts[ptr].value_len);
+		p += ctx->parts[ptr].value_len;
+		*p++ = ' ';
+	}
+	p[-!!n] = 0;
+
+	return rc;
+fail:
+	return NULL;
+}
+
+
+/**
+ * Print a string as a JSON string.
+ * 
+ * @param  f  The output stream.
+ * @param  s  The string.
+ */
+static void print_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if ((*s == '"') || (*s == '\\'))
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < ' ')
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+
+/**
+ * Print counters as members of a JSON object.
+ * 
+ * @param  f  The output stream.
+ * @param  c  The counters.
+ */
+static void print_json_counters(FILE *f, const struct trace_counters *c)
+{
+	fprintf(f, "\"dirs_opened\":%llu,\"dirents\":%llu,\"files_opened\":%llu,"
+	           "\"bytes_read\":%llu,\"version_cmps\":%llu,\"allocations\":%llu",
+	        c->dirs_opened, c->dirents, c->files_opened,
+	        c->bytes_read, c->version_cmps, c->allocations);
+}
+
+
+/**
+ * Start tracing a query, if queries are traced.
+ * 
+ * @param  ctx   The context.
+ * @param  argc  The number of elements in `argv`.
+ * @param  argv  The command line, including the process name.
+ */
+static void trace_begin(struct librarian *ctx, int argc, const char *const argv[])
+{
+	size_t size;
+	FILE *f;
+	int i;
+
+	if (ctx->trace_path == NULL)
+		return;
+	free(ctx->trace.argv);
+	free(ctx->trace.rounds);
+	memset(&ctx->trace, 0, sizeof(ctx->trace));
+	memset(&ctx->counters, 0, sizeof(ctx->counters));
+	ctx->trace.active = 1;
+	ctx->trace.start = trace_now(ctx);
+
+	f = open_memstream(&ctx->trace.argv, &size);
+	if (f == NULL)
+		return;
+	fputc('[', f);
+	for (i = 0; i < argc; i++) {
+		if (i)
+			fputc(',', f);
+		print_json_string(f, argv[i]);
+	}
+	fputc(']', f);
+	if (fclose(f)) {
+		free(ctx->trace.argv);
+		ctx->trace.argv = NULL;
+	}
+}
+
+
+/**
+ * Start tracing a round of find_librarian_files(),
+ * if a query is traced.
+ * 
+ * @param  ctx  The context.
+ * @param  n    The number of sought library specifications.
+ */
+static void trace_round_begin(struct librarian *ctx, size_t n)
+{
+	struct trace *trace = &ctx->trace;
+	struct trace_round *round;
+
+	if (!trace->active)
+		return;
+	if (trace->rounds_count == trace->rounds_size) {
+		round = counted_realloc(trace->rounds, (trace->rounds_size ? 2 * trace->rounds_size : 8) * sizeof(*round));
+		if (round == NULL)
+			return;
+		trace->rounds = round;
+		trace->rounds_size = trace->rounds_size ? 2 * trace->rounds_size : 8;
+	}
+	round = trace->rounds + trace->rounds_count++;
+	round->libraries = n;
+	round->found = 0;
+	round->counters = ctx->counters;
+	round->time = trace_now(ctx);
+}
+
+
+/**
+ * Finish tracing a round of find_librarian_files().
+ * 
+ * @param  ctx    The context.
+ * @param  found  The number of files the round found.
+ */
+static void trace_round_end(struct librarian *ctx, size_t found)
+{
+	const struct trace_counters *counters = &ctx->counters;
+	struct trace_round *round;
+
+	if (!ctx->trace.active || !ctx->trace.rounds_count)
+		return;
+	round = ctx->trace.rounds + ctx->trace.rounds_count - 1;
+	round->time = trace_now(ctx) - round->time;
+	round->found = found;
+	round->counters.dirs_opened  = counters->dirs_opened  - round->counters.dirs_opened;
+	round->counters.dirents      = counters->dirents      - round->counters.dirents;
+	round->counters.files_opened = counters->files_opened - round->counters.files_opened;
+	round->counters.bytes_read   = counters->bytes_read   - round->counters.bytes_read;
+	round->counters.version_cmps = counters->version_cmps - round->counters.version_cmps;
+	round->counters.allocations  = counters->allocations  - round->counters.allocations;
+}
+
+
+/**
+ * Append the trace of the query to the file named by
+ * LIBRARIAN_TRACE, as one line of JSON. The line is
+ * written with one write(2), so that concurrent
+ * processes can share the file. Errors are ignored.
+ * 
+ * @param  ctx     The context.
+ * @param  status  The exit status of the query.
+ */
+static void trace_end(struct librarian *ctx, int status)
+{
+	struct trace *trace = &ctx->trace;
+	struct found_file *ff;
+	char *buf = NULL;
+	size_t size = 0, i;
+	FILE *f;
+	int fd;
+
+	if (!trace->active)
+		return;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL)
+		goto out;
+	fprintf(f, "{\"pid\":%li,\"argv\":%s,\"status\":%i,\"time_us\":%.1f,",
+	        (long)getpid(), trace->argv ? trace->argv : "[]", status, trace_now(ctx) - trace->start);
+	print_json_counters(f, &ctx->counters);
+	fprintf(f, ",\"phases\":{\"parse_us\":%.1f,\"resolve_us\":%.1f,\"variables_us\":%.1f,\"rounds\":[",
+	        trace->parse_time, trace->resolve_time, trace->variables_time);
+	for (i = 0; i < trace->rounds_count; i++) {
+		fprintf(f, "%s{\"time_us\":%.1f,\"libraries\":%zu,\"found\":%zu,", i ? "," : "",
+		        trace->rounds[i].time, trace->rounds[i].libraries, trace->rounds[i].found);
+		print_json_counters(f, &trace->rounds[i].counters);
+		fputc('}', f);
+	}
+	fprintf(f, "]},\"libraries\":[");
+	for (i = 0; i < ctx->found_files_count; i++) {
+		ff = ctx->found_files + i;
+		fprintf(f, "%s{\"name\":", i ? "," : "");
+		print_json_string(f, ff->name);
+		fprintf(f, ",\"version\":");
+		print_json_string(f, ff->version);
+		fprintf(f, ",\"path\":");
+		print_json_string(f, ff->path);
+		if (ff->round == SIZE_MAX)
+			fprintf(f, ",\"round\":null");
+		else
+			fprintf(f, ",\"round\":%zu", ff->round);
+		fprintf(f, ",\"bytes\":%zu,\"load_us\":%.1f,\"lookups\":%zu,\"lookup_us\":%.1f}",
+		        ff->parsed ? ff->parsed->size : 0, ff->load_time, ff->lookups, ff->lookup_time);
+	}
+	fprintf(f, "]}\n");
+	if (fclose(f))
+		goto out;
+
+	fd = open(ctx->trace_path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd >= 0) {
+		if (write(fd, buf, size) < 0)
+			errno = 0;
+		close(fd);
+	}
+
+out:
+	free(buf);
+	free(trace->argv);
+	free(trace->rounds);
+	memset(trace, 0, sizeof(*trace));
+}
+
+
+/**
+ * Forget the result of the last call to librarian_resolve(),
+ * and finish its trace unless it was started with
+ * librarian_trace_begin(). The arrays are kept, for
+ * the next call.
+ * 
+ * @param  ctx  The context.
+ */
+static void clear_result(struct librarian *ctx)
+{
+	if (ctx->trace.implicit)
+		trace_end(ctx, ctx->trace.status);
+	ctx->found_files_count = 0;
+	if (ctx->found_map != NULL)
+		memset(ctx->found_map, 0, (ctx->found_map_mask + 1) * sizeof(*ctx->found_map));
+	free_resolver(ctx->resolver);
+	ctx->resolver = NULL;
+	while (ctx->libraries_count)
+		free_library(ctx->libraries + --ctx->libraries_count);
+	free(ctx->missing);
+	ctx->missing = NULL;
+	ctx->consulted_count = 0;
+	arena_release(&ctx->arena, 0);
+	ctx->query++;
+}
+
+
+/**
+ * Create a context. The context has an empty
+ * LIBRARIAN_PATH, does not index directories,
+ * does not trace queries, and uses one thread
+ * per online processor.
+ * 
+ * @return  The context, `NULL` on error. Shall be
+ *          released with librarian_destroy().
+ */
+struct librarian *librarian_create(void)
+{
+	struct librarian *ctx;
+
+	counting = NULL;
+	ctx = counted_calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+#ifdef _SC_NPROCESSORS_ONLN
+	ctx->jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (ctx->jobs < 1)
+		ctx->jobs = 1;
+	return ctx;
+}
+
+
+/**
+ * Release a context.
+ * 
+ * @param  ctx  The context, may be `NULL`.
+ */
+void librarian_destroy(struct librarian *ctx)
+{
+	if (ctx == NULL)
+		return;
+	enter(ctx);
+	clear_result(ctx);
+	librarian_release_caches(ctx);
+	while (ctx->indices_count)
+		free_index(ctx->indices + --ctx->indices_count);
+	free(ctx->indices);
+	arena_release(&ctx->arena, 1);
+	free(ctx->found_files);
+	free(ctx->found_map);
+	free(ctx->libraries);
+	free(ctx->parts);
+	free(ctx->trace.argv);
+	free(ctx->trace.rounds);
+	free(ctx->consulted);
+	free(ctx->trace_path);
+	free(ctx->index_dir);
+	free(ctx->path);
+	librarian__close_ring(ctx->ring);
+	free(ctx);
+	counting = NULL;
+}
+
+
+/**
+ * Replace LIBRARIAN_PATH.
+ * 
+ * @param   ctx   The context.
+ * @param   path  Colon-separated list of directories to search
+ *                for librarian files, `NULL` for none.
+ * @return        0 on success, -1 on error.
+ */
+int librarian_set_path(struct librarian *ctx, const char *path)
+{
+	char *new = NULL;
+
+	enter(ctx);
+	if (path && *path) {
+		new = counted_strdup(path);
+		if (new == NULL)
+			return -1;
+	}
+	free(ctx->path);
+	ctx->path = new;
+	return 0;
+}
+
+
+/**
+ * Append a directory to LIBRARIAN_PATH.
+ * 
+ * @param   ctx  The context.
+ * @param   dir  The directory, or colon-separated
+ *               list of directories.
+ * @return       0 on success, -1 on error.
+ */
+int librarian_add_path(struct librarian *ctx, const char *dir)
+{
+	size_t len = ctx->path ? strlen(ctx->path) : 0;
+	char *new;
+
+	enter(ctx);
+	new = counted_realloc(ctx->path, len + strlen(dir) + 2);
+	if (new == NULL)
+		return -1;
+	ctx->path = new;
+	if (len)
+		new[len++] = ':';
+	strcpy(new + len, dir);
+	return 0;
+}
+
+
+/**
+ * Select the directory in which to store indices of the
+ * directories in LIBRARIAN_PATH, like LIBRARIAN_INDEX.
+ * 
+ * @param   ctx  The context.
+ * @param   dir  The directory, `NULL` to not use index files.
+ * @return       0 on success, -1 on error.
+ */
+int librarian_set_index(struct librarian *ctx, const char *dir)
+{
+	char *new = NULL;
+
+	enter(ctx);
+	if (dir && *dir) {
+		new = counted_strdup(dir);
+		if (new == NULL)
+			return -1;
+	}
+	free(ctx->index_dir);
+	ctx->index_dir = new;
+	return 0;
+}
+
+
+/**
+ * Select the file to append traces of queries
+ * to, like LIBRARIAN_TRACE.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The file, `NULL` to not trace queries.
+ * @return        0 on success, -1 on error.
+ */
+int librarian_set_trace(struct librarian *ctx, const char *file)
+{
+	char *new = NULL;
+
+	enter(ctx);
+	if (file && *file) {
+		new = counted_strdup(file);
+		if (new == NULL)
+			return -1;
+	}
+	free(ctx->trace_path);
+	ctx->trace_path = new;
+	return 0;
+}
+
+
+/**
+ * Set the maximum number of threads to use
+ * when scanning LIBRARIAN_PATH.
+ * 
+ * @param  ctx   The context.
+ * @param  jobs  The number of threads, values
+ *               less than 1 are ignored.
+ */
+void librarian_set_jobs(struct librarian *ctx, long jobs)
+{
+	if (jobs > 0)
+		ctx->jobs = jobs;
+}
+
+
+/**
+ * Select whether the indices of directories shall be kept
+ * in memory, so that each directory is read only once,
+ * even if index files are not used. Use librarian_invalidate()
+ * when a directory is modified.
+ * 
+ * @param  ctx   The context.
+ * @param  keep  Non-zero to keep indices in memory.
+ */
+void librarian_keep_indices(struct librarian *ctx, int keep)
+{
+	ctx->in_memory_indices = !!keep;
+}
+
+
+/**
+ * Select whether librarian files and databases shall be
+ * read into memory, rather than mapped. If a mapped file
+ * is truncated by another process, accessing the lost
+ * pages raises SIGBUS, which a long-lived process, such
+ * as the daemon, must not risk. Index files are always
+ * mapped, as they are only ever replaced, never truncated.
+ * 
+ * @param  ctx   The context.
+ * @param  copy  Non-zero to read files into memory.
+ */
+void librarian_copy_files(struct librarian *ctx, int copy)
+{
+	ctx->copy_files = !!copy;
+}
+
+
+/**
+ * Set a function to call before a directory is indexed,
+ * so that the caller can, for example, start watching it.
+ * 
+ * @param  ctx    The context.
+ * @param  watch  The function, `NULL` for none. Its first argument
+ *                is `data`, and its second argument is the directory.
+ *                It shall return 0 on success, and -1 on error, in which
+ *                case the directory will not be indexed.
+ * @param  data   The first argument for `watch`.
+ */
+void librarian_set_watch(struct librarian *ctx, int (*watch)(void *data, const char *path), void *data)
+{
+	ctx->watch_directory = watch;
+	ctx->watch_data = data;
+}
+
+
+/**
+ * Serve a directory from a database in memory, created
+ * with librarian_compile(), rather than from the directory
+ * itself, for example a database compiled into the program.
+ * The directory is then searched without any system calls
+ * wherever it appears in LIBRARIAN_PATH, and is never
+ * considered modified.
+ * 
+ * @param   ctx   The context.
+ * @param   dir   The pathname of the directory, as it
+ *                appears in LIBRARIAN_PATH.
+ * @param   data  The database, suitably aligned for `uint64_t`.
+ *                It is not copied, and must not be modified or
+ *                released until the context is destroyed.
+ * @param   size  The size of `data`.
+ * @return        0 on success, -1 on error, `errno` is set to
+ *                `EBADMSG` if the database is corrupt, and to
+ *                `EEXIST` if the directory already is embedded.
+ */
+int librarian_embed(struct librarian *ctx, const char *dir, const void *data, size_t size)
+{
+	struct dir_index *idx;
+
+	enter(ctx);
+	idx = find_index(ctx, dir);
+	if ((idx != NULL) && idx->borrowed) {
+		errno = EEXIST;
+		return -1;
+	}
+	librarian_invalidate(ctx, dir);
+
+	REALLOC(ctx->indices, ctx->indices_count + 1);
+	idx = ctx->indices + ctx->indices_count;
+	memset(idx, 0, sizeof(*idx));
+	idx->data = (char *)data;
+	idx->size = size;
+	idx->borrowed = 1;
+	if (!check_database(idx)) {
+		errno = EBADMSG;
+		goto fail;
+	}
+	idx->path = counted_strdup(dir);
+	t (idx->path == NULL);
+
+	ctx->indices_count++;
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * Start tracing a query, if queries are traced. If this is
+ * not called, each call to librarian_resolve() is traced
+ * until the next call to librarian_resolve().
+ * 
+ * @param  ctx   The context.
+ * @param  argc  The number of elements in `argv`.
+ * @param  argv  The command line, or other description of
+ *               the query, to include in the trace.
+ */
+void librarian_trace_begin(struct librarian *ctx, int argc, char *const argv[])
+{
+	enter(ctx);
+	if (ctx->trace.implicit)
+		trace_end(ctx, ctx->trace.status);
+	trace_begin(ctx, argc, (const char *const *)argv);
+}
+
+
+/**
+ * Finish tracing a query started with librarian_trace_begin(),
+ * and append its trace to the trace file.
+ * 
+ * @param  ctx     The context.
+ * @param  status  The exit status of the query.
+ */
+void librarian_trace_end(struct librarian *ctx, int status)
+{
+	enter(ctx);
+	trace_end(ctx, status);
+}
+
+
+/**
+ * Find librarian files for libraries, replacing the
+ * result of the last call.
+ * 
+ * @param   ctx    The context.
+ * @param   specs  The library specifications, as on the command line.
+ * @param   n      The number of elements in `specs`.
+ * @param   flags  `LIBRARIAN_DEPS` to also find the dependencies of the
+ *                 libraries, recursively, and `LIBRARIAN_OLDEST` to prefer
+ *                 the oldest, rather than the newest, versions.
+ * @return         0: Successful and found all files.
+ *                 1: A library was not found, see librarian_missing().
+ *                 -1: An error occurred, `errno` is set to `EINVAL`
+ *                     if a specification is malformed.
+ */
+int librarian_resolve(struct librarian *ctx, const char *const *specs, size_t n, int flags)
+{
+	int deps = flags & LIBRARIAN_DEPS, oldest = !!(flags & LIBRARIAN_OLDEST);
+	const char *deps_string = "deps";
+	struct library missing = {0};
+	size_t start_files, end_files, last_files = 0;
+	size_t start_libs, count, i;
+	char empty[1] = "";
+	char *path = ctx->path ? ctx->path : empty;
+	char *data;
+	char *s;
+	char *end;
+	double start;
+	int r;
+
+	enter(ctx);
+	clear_result(ctx);
+	ctx->prefetch = deps;
+	if (!ctx->trace.active) {
+		trace_begin(ctx, (int)n, specs);
+		ctx->trace.implicit = ctx->trace.active;
+	}
+
+	/* Parse the specifications. */
+	if (ctx->libraries_size < n + !n) {
+		ctx->libraries_size = n + !n;
+		REALLOC(ctx->libraries, ctx->libraries_size);
+	}
+	for (i = 0; i < n; i++) {
+		s = arena_strndup(&ctx->arena, specs[i], strlen(specs[i]));
+		t (s == NULL);
+		r = parse_library(s, ctx->libraries + ctx->libraries_count++);
+		t (r < 0);
+		if (r) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+	count = ctx->libraries_count;
+	ctx->trace.parse_time = trace_now(ctx) - ctx->trace.start;
+
+	/* Every directory is searched, unless nothing is sought. */
+	for (s = path; n && s; s = end ? (end + 1) : NULL) {
+		end = strchr(s, ':');
+		i = end ? (size_t)(end - s) : strlen(s);
+		if (i)
+			t (consult(ctx, s, i));
+	}
+
+	/* Find librarian files. */
+	for (start_libs = 0; (n = ctx->libraries_count - start_libs);) {
+		last_files = start_files = ctx->found_files_count;
+		trace_round_begin(ctx, n);
+		r = find_librarian_files(ctx, ctx->libraries + start_libs, n, path, oldest, &missing);
+		trace_round_end(ctx, ctx->found_files_count - start_files);
+		if (r) {
+			t (errno);
+			if (deps) {
+				/* Try other versions than the preferred ones. */
+				start = trace_now(ctx);
+				r = resolve(ctx, ctx->libraries, count, path, oldest, &ctx->resolver);
+				ctx->trace.resolve_time += trace_now(ctx) - start;
+				if (!r)
+					goto found;
+				t (errno);
+			}
+			t (set_missing(ctx, &missing));
+			goto not_found;
+		}
+		start_libs += n;
+		if (!deps)
+			break;
+		start = trace_now(ctx);
+		load_files(ctx, start_files, ctx->found_files_count);
+		for (end_files = ctx->found_files_count; start_files < end_files; start_files++) {
+			data = get_variables(ctx, &deps_string, 1 + &deps_string, start_files, start_files + 1, 1);
+			t (data == NULL);
+			for (end = s = data; end; s = end + 1) {
+				while (isspace(*s))
+					s++;
+				if ((end = strpbrk(s, " \t\r\n\f\v")))
+					*end = '\0';
+				MAYBE_GROW(ctx->libraries, ctx->libraries_count, ctx->libraries_size, 1);
+				r = *s ? parse_library(s, ctx->libraries + ctx->libraries_count++) : 0;
+				t (r < 0);
+				if (r)
+					goto not_found;
+				if (*s)
+					ctx->libraries[ctx->libraries_count - 1].origin = start_files + 1;
+			}
+		}
+		ctx->trace.variables_time += trace_now(ctx) - start;
+	}
+
+	/* Each round appends its files by name, list the files from
+	 * the earlier rounds by name too, before those from the last. */
+	if (last_files)
+		qsort(ctx->found_files, last_files, sizeof(*ctx->found_files), found_file_name_cmp);
+
+found:
+	ctx->trace.status = 0;
+	return 0;
+
+not_found:
+	ctx->trace.status = 2;
+	return 1;
+fail:
+	ctx->trace.status = 1;
+	return -1;
+}
+
+
+/**
+ * Get the library that the last call to
+ * librarian_resolve() could not find.
+ * 
+ * @param   ctx  The context.
+ * @return       The library, as a library specification,
+ *               `NULL` if all libraries were found or if
+ *               a librarian file has a malformed `deps`.
+ */
+const char *librarian_missing(const struct librarian *ctx)
+{
+	return ctx->missing;
+}
+
+
+/**
+ * Get the number of librarian files found
+ * by the last call to librarian_resolve().
+ * 
+ * @param   ctx  The context.
+ * @return       The number of files.
+ */
+size_t librarian_count(const struct librarian *ctx)
+{
+	return ctx->found_files_count;
+}
+
+
+/**
+ * Get the pathname of a librarian file found
+ * by the last call to librarian_resolve().
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The pathname, `NULL` if `i` is out of range.
+ */
+const char *librarian_file(const struct librarian *ctx, size_t i)
+{
+	return i < ctx->found_files_count ? ctx->found_files[i].path : NULL;
+}
+
+
+/**
+ * Get the name of the library of a librarian file
+ * found by the last call to librarian_resolve().
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The name, `NULL` if `i` is out of range.
+ */
+const char *librarian_name(const struct librarian *ctx, size_t i)
+{
+	return i < ctx->found_files_count ? ctx->found_files[i].name : NULL;
+}
+
+
+/**
+ * Get the version of the library of a librarian file
+ * found by the last call to librarian_resolve().
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The version, `NULL` if `i` is out of range.
+ */
+const char *librarian_version(const struct librarian *ctx, size_t i)
+{
+	return i < ctx->found_files_count ? ctx->found_files[i].version : NULL;
+}
+
+
+/**
+ * Get a directory or librarian file that the result
+ * of the last call to librarian_resolve(), and of the
+ * calls to librarian_get() since, depends on. If none
+ * of them is modified, the same query will give the
+ * same result.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the directory or file.
+ * @return       The pathname, as it appeared in LIBRARIAN_PATH
+ *               or in librarian_file(), `NULL` if `i` is out
+ *               of range.
+ */
+const char *librarian_consulted(const struct librarian *ctx, size_t i)
+{
+	return i < ctx->consulted_count ? ctx->consulted[i] : NULL;
+}
+
+
+/**
+ * Get the values of variables in the librarian files
+ * found by the last call to librarian_resolve().
+ * 
+ * @param   ctx   The context.
+ * @param   vars  The names of the variables.
+ * @param   n     The number of elements in `vars`.
+ * @return        The non-empty values, separated by spaces, `NULL`
+ *                on error. Shall be released with free(3).
+ */
+char *librarian_get(struct librarian *ctx, const char *const *vars, size_t n)
+{
+	double start;
+	char *rc;
+
+	enter(ctx);
+	start = trace_now(ctx);
+	rc = get_variables(ctx, vars, vars + n, 0, ctx->found_files_count, 0);
+	ctx->trace.variables_time += trace_now(ctx) - start;
+	return rc;
+}
+
+
+/**
+ * Compares two librarian files to store in a database,
+ * first by library name, then by version, then by the
+ * directory they were found in, and last by filename.
+ * 
+ * @param   a:const struct db_entry *  One of the files.
+ * @param   b:const struct db_entry *  The other file.
+ * @return                             <0: `a` < `b`.
+ *                                     =0: `a` = `b`.
+ *                                     >0: `a` > `b`.
+ */
+static int db_entry_cmp(const void *a, const void *b)
+{
+	const struct db_entry *ea = a;
+	const struct db_entry *eb = b;
+	const char *va;
+	const char *vb;
+	size_t la, lb;
+	int r;
+
+	GET_VERSION(va, ea->name);
+	GET_VERSION(vb, eb->name);
+	la = (size_t)(va - ea->name);
+	lb = (size_t)(vb - eb->name);
+	r = memcmp(ea->name, eb->name, la < lb ? la : lb);
+	if (r)  return r;
+	if (la != lb)  return la < lb ? -1 : +1;
+	r = version_key_cmp(&ea->key, &eb->key);
+	if (r)  return r;
+	if (ea->rank != eb->rank)  return ea->rank < eb->rank ? -1 : +1;
+	return strcmp(ea->name, eb->name);
+}
+
+
+/**
+ * Test whether a library specification names a library.
+ * 
+ * @param   lib   The library specification, a name ending
+ *                with `*` matches every name it is a prefix of.
+ * @param   name  The name of the library.
+ * @return        1 if the names match, 0 otherwise.
+ */
+static int match_name(const struct library *lib, const char *name)
+{
+	size_t len = strlen(lib->name);
+	if (len && (lib->name[len - 1] == '*'))
+		return !strncmp(lib->name, name, len - 1);
+	return !strcmp(lib->name, name);
+}
+
+
+/**
+ * List the librarian files in LIBRARIAN_PATH, sorted by
+ * library name, version and directory.
+ * 
+ * @param   ctx         The context.
+ * @param   dirs        The directories and databases in LIBRARIAN_PATH.
+ * @param   dirs_count  The number of elements in `dirs`.
+ * @param   libs        Library specifications, only the files that
+ *                      match any of them are listed, see match_name().
+ * @param   n           The number of elements in `libs`, 0 to list
+ *                      every file.
+ * @param   shadowed    Shall files that have the same version as a
+ *                      file in an earlier directory be listed? They
+ *                      are only found when the dependency resolver
+ *                      rejects the earlier file.
+ * @param   entries     Output parameter for the files, the indices
+ *                      are kept in `ctx` and outlive them. Shall be
+ *                      released with free(3), after their keys.
+ * @param   count       Output parameter for the number of elements
+ *                      in `entries`.
+ * @return              0 on success, -1 on error.
+ */
+static int list_files(struct librarian *ctx, char **dirs, size_t dirs_count, const struct library *libs, size_t n,
+                      int shadowed, struct db_entry **entries, size_t *count)
+{
+	size_t size = 0, rank = 0, i, j, k, e, end;
+	struct dir_index *idx;
+	struct index_header *head;
+	struct db_entry *entry;
+	const char *name;
+	char *p;
+
+	*entries = NULL;
+	*count = 0;
+	for (i = 0; i < dirs_count; i++) {
+		idx = get_index(ctx, dirs[i]);
+		t (idx == NULL);
+		head = (struct index_header *)(idx->data);
+		for (j = 0; j < head->names; j++) {
+			name = idx->data + idx->names[j].name;
+			for (k = 0; k < n && !match_name(libs + k, name); k++);
+			if (n && (k == n))
+				continue;
+			e = (size_t)(idx->names[j].first);
+			for (end = e + (size_t)(idx->names[j].count); e < end; e++) {
+				MAYBE_GROW(*entries, *count, size, 64);
+				entry = *entries + *count;
+				entry->name = idx->data + idx->entries[e];
+				entry->dir = i;
+				entry->rank = rank + entry_dir(idx, e);
+				entry->zeros = 0;
+				entry->file = NULL;
+				GET_VERSION(p, entry->name);
+				t (make_version_key(&entry->key, p + 1));
+				for (k = 0; k < n; k++)
+					if (match_name(libs + k, name) && test_library_version(&entry->key, libs + k))
+						break;
+				if (n && (k == n))
+					free_version_key(&entry->key);
+				else
+					++*count;
+			}
+		}
+		rank += index_dirs(idx);
+	}
+	qsort(*entries, *count, sizeof(**entries), db_entry_cmp);
+	if (shadowed)
+		return 0;
+
+	for (entry = *entries, i = j = 0; i < *count; i++) {
+		if (j && (entry[i].rank != entry[j - 1].rank) && !version_key_cmp(&entry[i].key, &entry[j - 1].key)) {
+			GET_VERSION(p, entry[i].name);
+			k = (size_t)(p - entry[i].name) + 1;
+			if (!strncmp(entry[i].name, entry[j - 1].name, k)) {
+				free_version_key(&entry[i].key);
+				continue;
+			}
+		}
+		entry[j++] = entry[i];
+	}
+	*count = j;
+	return 0;
+
+fail:
+	RETURN (-1) {
+	while (*count)
+		free_version_key(&(*entries)[--*count].key);
+	free(*entries);
+	*entries = NULL;
+	}
+}
+
+
+/**
+ * Test whether two versions are spelled the
+ * same once zeros have been prepended to them.
+ * 
+ * @param   a   One of the versions.
+ * @param   za  The number of zeros to prepend to `a`.
+ * @param   b   The other version.
+ * @param   zb  The number of zeros to prepend to `b`.
+ * @return      1 if the versions are spelled the same, 0 otherwise.
+ */
+static int same_padded(const char *a, size_t za, const char *b, size_t zb)
+{
+	for (; za > zb; za--)
+		if (*b++ != '0')
+			return 0;
+	for (; zb > za; zb--)
+		if (*a++ != '0')
+			return 0;
+	return !strcmp(a, b);
+}
+
+
+/**
+ * Give each file in a database a filename that no other file
+ * of the library has, by prepending zeros to the version of
+ * files that have the same version as a file in an earlier
+ * directory, which does not change the version.
+ * 
+ * @param  entries  The files, as listed by list_files().
+ * @param  count    The number of elements in `entries`.
+ */
+static void pad_versions(struct db_entry *entries, size_t count)
+{
+	const char *ver;
+	const char *other;
+	size_t i, j, run = 0;
+
+	for (i = 0; i < count; i++) {
+		GET_VERSION(ver, entries[i].name);
+		if (!i || version_key_cmp(&entries[i].key, &entries[i - 1].key) ||
+		    strncmp(entries[i].name, entries[i - 1].name, (size_t)(ver - entries[i].name) + 1))
+			run = i;
+		/* Only files with the same version can have the same filename. */
+		for (j = run; j < i;) {
+			GET_VERSION(other, entries[j].name);
+			if (same_padded(ver, entries[i].zeros, other, entries[j].zeros))
+				entries[i].zeros++, j = run;
+			else
+				j++;
+		}
+	}
+}
+
+
+/**
+ * Compile the librarian files in LIBRARIAN_PATH into a
+ * database, that can be used in place of the directories
+ * in LIBRARIAN_PATH. Files that have the same version as
+ * a file in an earlier directory are kept, as they are
+ * found if the dependency resolver rejects the earlier
+ * file, but with zeros prepended to their version, to
+ * give them unique filenames. The database gives the same
+ * results as the directories, except that the pathnames
+ * of files are in the database.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The pathname of the database.
+ * @return        0 on success, -1 on error.
+ */
+int librarian_compile(struct librarian *ctx, const char *file)
+{
+	struct db_entry *entries = NULL;
+	size_t entries_count = 0;
+	size_t names = 0, vars = 0, strings = 1, dirs_total = 0;
+	size_t dirs_count = 0, len = 0, i, j, k, off;
+	char **dirs = NULL;
+	char *path = ctx->path;
+	char *data = NULL;
+	char *p;
+	struct db_header *dbhead;
+	struct index_name *name = NULL;
+	uint64_t *offsets;
+	struct db_file *files;
+	struct db_variable *variables;
+	struct db_variable *dbvar;
+	const struct variable *var;
+	struct parsed_file *f;
+	struct dir_index *idx;
+
+	enter(ctx);
+	if (path != NULL) {
+		len = strlen(path);
+		t (split_path(path, &dirs, &dirs_count));
+	}
+
+	/* List the files, including files shadowed by a file with the same version, and load them. */
+	t (list_files(ctx, dirs, dirs_count, NULL, 0, 1, &entries, &entries_count));
+	pad_versions(entries, entries_count);
+	for (i = 0; i < dirs_count; i++) {
+		idx = get_index(ctx, dirs[i]);
+		t (idx == NULL);
+		dirs_total += index_dirs(idx);
+	}
+	for (i = 0; i < entries_count; i++) {
+		p = counted_malloc(strlen(dirs[entries[i].dir]) + strlen(entries[i].name) + 2);
+		t (p == NULL);
+		stpcpy(stpcpy(stpcpy(p, dirs[entries[i].dir]), "/"), entries[i].name);
+		entries[i].file = f = get_file(ctx, p);
+		free(p);
+		t (f == NULL);
+		while (f->scanned < f->size) {
+			var = index_line(f);
+			t (!var && errno);
+		}
+		vars += f->count;
+		GET_VERSION(p, entries[i].name);
+		k = (size_t)(p - entries[i].name) + 1;
+		if (!i || strncmp(entries[i - 1].name, entries[i].name, k))
+			names++, strings += k;
+		strings += strlen(entries[i].name) + entries[i].zeros + 1;
+		for (j = 0; j <= f->mask; j++)
+			if (f->vars[j].name != NULL)
+				strings += f->vars[j].name_len + f->vars[j].value_len;
+	}
+
+	/* Build the database. */
+	off = sizeof(*dbhead) + names * sizeof(*name) + entries_count * (sizeof(*offsets) + sizeof(*files));
+	off += vars * sizeof(*variables);
+	data = counted_calloc(off + strings, 1);
+	t (data == NULL);
+	dbhead = (struct db_header *)data;
+	memcpy(dbhead->index.magic, DB_MAGIC, sizeof(dbhead->index.magic));
+	dbhead->index.names = (uint64_t)names;
+	dbhead->index.entries = (uint64_t)entries_count;
+	dbhead->index.size = (uint64_t)(off + strings);
+	dbhead->variables = (uint64_t)vars;
+	dbhead->dirs = (uint64_t)dirs_total;
+	offsets = (uint64_t *)((struct index_name *)(data + sizeof(*dbhead)) + names);
+	files = (struct db_file *)(offsets + entries_count);
+	dbvar = variables = (struct db_variable *)(files + entries_count);
+	for (i = 0; i < entries_count; i++) {
+		f = entries[i].file;
+		GET_VERSION(p, entries[i].name);
+		k = (size_t)(p - entries[i].name);
+		if (!i || strncmp(entries[i - 1].name, entries[i].name, k + 1)) {
+			name = name ? (name + 1) : (struct index_name *)(data + sizeof(*dbhead));
+			name->name = (uint64_t)off;
+			name->first = (uint64_t)i;
+			memcpy(data + off, entries[i].name, k);
+			off += k + 1;
+		}
+		name->count++;
+		offsets[i] = (uint64_t)off;
+		memcpy(data + off, entries[i].name, k + 1);
+		memset(data + off + k + 1, '0', entries[i].zeros);
+		off += k + 1 + entries[i].zeros;
+		off = (size_t)(stpcpy(data + off, p + 1) - data) + 1;
+		files[i].first = (uint64_t)(dbvar - variables);
+		files[i].count = (uint64_t)(f->count);
+		files[i].dir = (uint64_t)(entries[i].rank);
+		for (j = 0; j <= f->mask; j++) {
+			if (f->vars[j].name == NULL)
+				continue;
+			dbvar->name = (uint64_t)off;
+			dbvar->name_len = (uint64_t)(f->vars[j].name_len);
+			memcpy(data + off, f->vars[j].name, f->vars[j].name_len);
+			off += f->vars[j].name_len;
+			dbvar->value = (uint64_t)off;
+			dbvar->value_len = (uint64_t)(f->vars[j].value_len);
+			memcpy(data + off, f->vars[j].value, f->vars[j].value_len);
+			off += f->vars[j].value_len;
+			dbvar++;
+		}
+	}
+
+	t (replace_file(file, data, (size_t)(dbhead->index.size), 0644));
+
+	restore_path(path, len);
+	while (entries_count--)
+		free_version_key(&entries[entries_count].key);
+	free(entries);
+	free(dirs);
+	free(data);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (path != NULL)
+		restore_path(path, len);
+	while (entries_count--)
+		free_version_key(&entries[entries_count].key);
+	free(entries);
+	free(dirs);
+	free(data);
+	}
+}
+
+
+/**
+ * List every librarian file that can be found in
+ * LIBRARIAN_PATH, sorted by library name and version.
+ * The files are available from librarian_count(),
+ * librarian_file(), librarian_name() and
+ * librarian_version(), as if they were found by
+ * librarian_resolve(), and librarian_get() can
+ * be used on them.
+ * 
+ * @param   ctx    The context.
+ * @param   specs  Library specifications, as on the command line, only
+ *                 the files that match any of them are listed. A name
+ *                 ending with `*` matches every name it is a prefix of.
+ * @param   n      The number of elements in `specs`, 0 to list every file.
+ * @return         0 on success, -1 on error, `errno` is set to
+ *                 `EINVAL` if a specification is malformed.
+ */
+int librarian_list(struct librarian *ctx, const char *const *specs, size_t n)
+{
+	struct db_entry *entries = NULL;
+	size_t entries_count = 0, dirs_count = 0, len = 0, i;
+	struct found_file *ff;
+	char **dirs = NULL;
+	char *path = ctx->path;
+	char *s;
+	int r;
+
+	enter(ctx);
+	clear_result(ctx);
+
+	/* Parse the specifications. */
+	if (ctx->libraries_size < n + !n) {
+		ctx->libraries_size = n + !n;
+		REALLOC(ctx->libraries, ctx->libraries_size);
+	}
+	for (i = 0; i < n; i++) {
+		s = arena_strndup(&ctx->arena, specs[i], strlen(specs[i]));
+		t (s == NULL);
+		r = parse_library(s, ctx->libraries + ctx->libraries_count++);
+		t (r < 0);
+		if (r) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	if (path != NULL) {
+		len = strlen(path);
+		t (split_path(path, &dirs, &dirs_count));
+	}
+	for (i = 0; i < dirs_count; i++)
+		t (consult(ctx, dirs[i], strlen(dirs[i])));
+	t (list_files(ctx, dirs, dirs_count, ctx->libraries, n, 0, &entries, &entries_count));
+
+	if (ctx->found_files_size < entries_count) {
+		ctx->found_files_size = entries_count;
+		REALLOC(ctx->found_files, ctx->found_files_size);
+	}
+	for (i = 0; i < entries_count; i++) {
+		ff = ctx->found_files + i;
+		memset(ff, 0, sizeof(*ff));
+		GET_VERSION(s, entries[i].name);
+		ff->name = arena_strndup(&ctx->arena, entries[i].name, (size_t)(s - entries[i].name));
+		t (ff->name == NULL);
+		s = arena_alloc(&ctx->arena, strlen(dirs[entries[i].dir]) + strlen(entries[i].name) + 2);
+		t (s == NULL);
+		stpcpy(stpcpy(stpcpy(s, dirs[entries[i].dir]), "/"), entries[i].name);
+		ff->path = s;
+		GET_VERSION(ff->version, ff->path);
+		ff->version++;
+		ff->round = SIZE_MAX;
+	}
+	ctx->found_files_count = entries_count;
+
+	restore_path(path, len);
+	while (entries_count--)
+		free_version_key(&entries[entries_count].key);
+	free(entries);
+	free(dirs);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (path != NULL)
+		restore_path(path, len);
+	while (entries_count--)
+		free_version_key(&entries[entries_count].key);
+	free(entries);
+	free(dirs);
+	}
+}
+
+
+/**
+ * Locate a librarian file for each of a set of library
+ * specifications on its own, rather than for all of
+ * them together, for example to check which optional
+ * libraries are available. Each directory is indexed
+ * once, and every specification is looked up in
+ * the indices.
+ * 
+ * @param   ctx    The context.
+ * @param   specs  The library specifications, as on the command line.
+ * @param   n      The number of elements in `specs`.
+ * @param   flags  `LIBRARIAN_OLDEST` to prefer the oldest, rather
+ *                 than the newest, versions.
+ * @param   files  Output parameter for, for each specification, the
+ *                 pathname of the librarian file that would be found,
+ *                 `NULL` if none. The pathnames are valid until the
+ *                 next query.
+ * @return         0 on success, -1 on error, `errno` is set to
+ *                 `EINVAL` if a specification is malformed.
+ */
+int librarian_probe(struct librarian *ctx, const char *const *specs, size_t n, int flags, const char **files)
+{
+	int oldest = !!(flags & LIBRARIAN_OLDEST);
+	size_t dirs_count = 0, len = 0, i, j;
+	struct dir_index *idx;
+	char **dirs = NULL;
+	char **found = NULL;
+	struct version_key *keys = NULL;
+	char *path = ctx->path;
+	char *s;
+	int r;
+
+	enter(ctx);
+	clear_result(ctx);
+
+	/* Parse the specifications. */
+	if (ctx->libraries_size < n + !n) {
+		ctx->libraries_size = n + !n;
+		REALLOC(ctx->libraries, ctx->libraries_size);
+	}
+	for (i = 0; i < n; i++) {
+		s = arena_strndup(&ctx->arena, specs[i], strlen(specs[i]));
+		t (s == NULL);
+		r = parse_library(s, ctx->libraries + ctx->libraries_count++);
+		t (r < 0);
+		if (r) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	if (path != NULL) {
+		len = strlen(path);
+		t (split_path(path, &dirs, &dirs_count));
+	}
+	found = counted_calloc(n + !n, sizeof(*found));
+	t (found == NULL);
+	keys = counted_calloc(n + !n, sizeof(*keys));
+	t (keys == NULL);
+	if (ctx->jobs > 1 && dirs_count > 1)
+		preload_indices(ctx, dirs, dirs_count);
+	for (i = 0; n && i < dirs_count; i++) {
+		t (consult(ctx, dirs[i], strlen(dirs[i])));
+		idx = get_index(ctx, dirs[i]);
+		t (idx == NULL);
+		for (j = 0; j < n; j++) {
+			s = locate_in_index(ctx->libraries + j, 1, idx, oldest);
+			t (!s && errno);
+			if (s != NULL)
+				t (update_best(found + j, keys + j, s, NULL, oldest));
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		files[i] = found[i] ? arena_intern(&ctx->arena, found[i], strlen(found[i])) : NULL;
+		t (found[i] && !files[i]);
+	}
+
+	restore_path(path, len);
+	while (n--) {
+		free(found[n]);
+		free_version_key(keys + n);
+	}
+	free(keys);
+	free(found);
+	free(dirs);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	if (path != NULL)
+		restore_path(path, len);
+	if (found != NULL)
+		for (i = 0; i < n; i++)
+			free(found[i]);
+	if (keys != NULL)
+		for (i = 0; i < n; i++)
+			free_version_key(keys + i);
+	free(keys);
+	free(found);
+	free(dirs);
+	}
+}
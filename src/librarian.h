@@ -0,0 +1,324 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#ifndef LIBRARIAN_H
+#define LIBRARIAN_H
+
+#include <stddef.h>
+
+
+/**
+ * Flag for librarian_resolve(): also find the
+ * dependencies of the libraries, recursively.
+ */
+#define LIBRARIAN_DEPS  0x0001
+
+/**
+ * Flag for librarian_resolve(): prefer the oldest,
+ * rather than the newest, versions of the libraries.
+ */
+#define LIBRARIAN_OLDEST  0x0002
+
+
+
+/**
+ * A context, holds the configuration, the loaded
+ * directory indices and librarian files, and the
+ * result of the last query, that is, the last call
+ * to librarian_resolve(), librarian_list() or
+ * librarian_probe(). A context may only be used
+ * by one thread at a time, but different contexts
+ * can be used concurrently.
+ */
+struct librarian;
+
+
+
+/**
+ * Create a context. The context has an empty
+ * LIBRARIAN_PATH, does not index directories,
+ * does not trace queries, and uses one thread
+ * per online processor.
+ * 
+ * @return  The context, `NULL` on error, with `errno` set.
+ *          Shall be released with librarian_destroy().
+ */
+struct librarian *librarian_create(void);
+
+/**
+ * Release a context, and every string it has returned,
+ * except those returned by librarian_get().
+ * 
+ * @param  ctx  The context, may be `NULL`.
+ */
+void librarian_destroy(struct librarian *ctx);
+
+
+/**
+ * Replace LIBRARIAN_PATH.
+ * 
+ * @param   ctx   The context.
+ * @param   path  Colon-separated list of directories, or databases
+ *                created with librarian_compile(), to search for
+ *                librarian files, `NULL` for none. It is copied.
+ * @return        0 on success, -1 on error, with `errno` set.
+ */
+int librarian_set_path(struct librarian *ctx, const char *path);
+
+/**
+ * Append a directory to LIBRARIAN_PATH.
+ * 
+ * @param   ctx  The context.
+ * @param   dir  The directory, or colon-separated list
+ *               of directories. It is copied.
+ * @return       0 on success, -1 on error, with `errno` set.
+ */
+int librarian_add_path(struct librarian *ctx, const char *dir);
+
+/**
+ * Select the directory in which to store indices of the
+ * directories in LIBRARIAN_PATH, like LIBRARIAN_INDEX.
+ * The directory is created when the first index is stored.
+ * Index files that cannot be read or written are ignored.
+ * 
+ * @param   ctx  The context.
+ * @param   dir  The directory, `NULL` to not use index
+ *               files. It is copied.
+ * @return       0 on success, -1 on error, with `errno` set.
+ */
+int librarian_set_index(struct librarian *ctx, const char *dir);
+
+/**
+ * Select the file to append traces of queries to, like
+ * LIBRARIAN_TRACE. Each call to librarian_resolve() is
+ * traced, with the calls to librarian_get() that follow it.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The file, `NULL` to not trace queries. It is copied.
+ * @return        0 on success, -1 on error, with `errno` set.
+ */
+int librarian_set_trace(struct librarian *ctx, const char *file);
+
+/**
+ * Set the maximum number of threads to use
+ * when scanning LIBRARIAN_PATH.
+ * 
+ * @param  ctx   The context.
+ * @param  jobs  The number of threads, values
+ *               less than 1 are ignored.
+ */
+void librarian_set_jobs(struct librarian *ctx, long jobs);
+
+/**
+ * Serve a directory from a database in memory, created
+ * with librarian_compile(), rather than from the directory
+ * itself, for example a database compiled into the program.
+ * The directory is then searched without any system calls
+ * wherever it appears in LIBRARIAN_PATH, and is never
+ * considered modified.
+ * 
+ * @param   ctx   The context.
+ * @param   dir   The pathname of the directory, as it appears
+ *                in LIBRARIAN_PATH. It is copied.
+ * @param   data  The database, suitably aligned for `uint64_t`.
+ *                It is not copied, and must not be modified or
+ *                released until the context is destroyed.
+ * @param   size  The size of `data`.
+ * @return        0 on success, -1 on error, with `errno` set,
+ *                to `EBADMSG` if the database is corrupt, and
+ *                to `EEXIST` if the directory already is embedded.
+ */
+int librarian_embed(struct librarian *ctx, const char *dir, const void *data, size_t size);
+
+
+/**
+ * Determine whether a string is the
+ * name of a non-reserved variable.
+ * 
+ * @param   s  The string.
+ * @return     1: The string is a variable name.
+ *             0: The string is a library.
+ */
+int librarian_is_variable(const char *s);
+
+/**
+ * Find librarian files for libraries. The result replaces
+ * that of the last call to librarian_resolve(), librarian_list()
+ * or librarian_probe(), and is available from librarian_count(),
+ * librarian_file(), librarian_name(), librarian_version(),
+ * librarian_get(), librarian_missing() and librarian_consulted().
+ * 
+ * @param   ctx    The context.
+ * @param   specs  The library specifications, as on the command line.
+ * @param   n      The number of elements in `specs`.
+ * @param   flags  `LIBRARIAN_DEPS` to also find the dependencies of the
+ *                 libraries, recursively, and `LIBRARIAN_OLDEST` to prefer
+ *                 the oldest, rather than the newest, versions.
+ * @return         0: Successful and found all files.
+ *                 1: A library was not found, see librarian_missing().
+ *                 -1: An error occurred, with `errno` set, to `EINVAL`
+ *                     if a specification is malformed, and to `EBADMSG`
+ *                     if a database in LIBRARIAN_PATH is corrupt.
+ */
+int librarian_resolve(struct librarian *ctx, const char *const *specs, size_t n, int flags);
+
+/**
+ * List every librarian file that can be found in LIBRARIAN_PATH,
+ * sorted by library name and version. The result replaces that
+ * of the last query, as with librarian_resolve(), and
+ * librarian_get() can be used on the listed files.
+ * 
+ * @param   ctx    The context.
+ * @param   specs  Library specifications, as on the command line, only
+ *                 the files that match any of them are listed. A name
+ *                 ending with `*` matches every name it is a prefix of.
+ * @param   n      The number of elements in `specs`, 0 to list every file.
+ * @return         0 on success, -1 on error, with `errno` set, to
+ *                 `EINVAL` if a specification is malformed, and to
+ *                 `EBADMSG` if a database in LIBRARIAN_PATH is corrupt.
+ */
+int librarian_list(struct librarian *ctx, const char *const *specs, size_t n);
+
+/**
+ * Locate a librarian file for each of a set of library
+ * specifications on its own, rather than for all of them
+ * together, for example to check which optional libraries
+ * are available. The result of the last query is cleared.
+ * 
+ * @param   ctx    The context.
+ * @param   specs  The library specifications, as on the command line.
+ * @param   n      The number of elements in `specs`.
+ * @param   flags  `LIBRARIAN_OLDEST` to prefer the oldest, rather
+ *                 than the newest, versions.
+ * @param   files  Output parameter for, for each specification, the
+ *                 pathname of the librarian file that would be found,
+ *                 `NULL` if none. The pathnames are owned by the context,
+ *                 and are valid until the next query.
+ * @return         0 on success, -1 on error, with `errno` set, to
+ *                 `EINVAL` if a specification is malformed, and to
+ *                 `EBADMSG` if a database in LIBRARIAN_PATH is corrupt.
+ */
+int librarian_probe(struct librarian *ctx, const char *const *specs, size_t n, int flags, const char **files);
+
+/**
+ * Get the library that the last call to
+ * librarian_resolve() could not find.
+ * 
+ * @param   ctx  The context.
+ * @return       The library, as a library specification, `NULL` if
+ *               all libraries were found or if a librarian file has
+ *               a malformed `deps`. The string is owned by the context,
+ *               and is valid until the next query.
+ */
+const char *librarian_missing(const struct librarian *ctx);
+
+/**
+ * Get the number of librarian files found by the last query.
+ * 
+ * @param   ctx  The context.
+ * @return       The number of files.
+ */
+size_t librarian_count(const struct librarian *ctx);
+
+/**
+ * Get the pathname of a librarian file found by the last query.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The pathname, `NULL` if `i` is out of range. The string
+ *               is owned by the context, and is valid until the next query.
+ */
+const char *librarian_file(const struct librarian *ctx, size_t i);
+
+/**
+ * Get the name of the library of a librarian
+ * file found by the last query.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The name, `NULL` if `i` is out of range. The string is
+ *               owned by the context, and is valid until the next query.
+ */
+const char *librarian_name(const struct librarian *ctx, size_t i);
+
+/**
+ * Get the version of the library of a librarian
+ * file found by the last query.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the file.
+ * @return       The version, `NULL` if `i` is out of range. The string
+ *               is owned by the context, and is valid until the next query.
+ */
+const char *librarian_version(const struct librarian *ctx, size_t i);
+
+/**
+ * Get the values of variables in the librarian
+ * files found by the last query.
+ * 
+ * @param   ctx   The context.
+ * @param   vars  The names of the variables.
+ * @param   n     The number of elements in `vars`.
+ * @return        The non-empty values, separated by spaces, `NULL` on
+ *                error, with `errno` set, for example to `ENOENT` if a
+ *                file has been removed. The string is owned by the caller,
+ *                and shall be released with free(3).
+ */
+char *librarian_get(struct librarian *ctx, const char *const *vars, size_t n);
+
+/**
+ * Get a directory or librarian file that the result
+ * of the last query, and of the calls to librarian_get()
+ * since, depends on. If none of them is modified, the
+ * same query will give the same result.
+ * 
+ * @param   ctx  The context.
+ * @param   i    The index of the directory or file.
+ * @return       The pathname, as it appeared in LIBRARIAN_PATH or in
+ *               librarian_file(), `NULL` if `i` is out of range. The
+ *               string is owned by the context, and is valid until
+ *               the next query.
+ */
+const char *librarian_consulted(const struct librarian *ctx, size_t i);
+
+
+/**
+ * Compile the librarian files in LIBRARIAN_PATH into a
+ * database, that can be used in place of the directories
+ * in LIBRARIAN_PATH, and gives the same results as the
+ * directories, except that pathnames of files are in the
+ * database. Files that have the same version as a file in
+ * an earlier directory are kept, as the dependency resolver
+ * chooses them if it rejects the earlier file, with zeros
+ * prepended to their version, which does not change it, to
+ * give them unique filenames. The database is replaced
+ * atomically.
+ * 
+ * @param   ctx   The context.
+ * @param   file  The pathname of the database.
+ * @return        0 on success, -1 on error, with `errno` set.
+ */
+int librarian_compile(struct librarian *ctx, const char *file);
+
+
+#endif
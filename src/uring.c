@@ -0,0 +1,468 @@
+/**
+ * MIT/X Consortium License
+ * 
+ * Copyright © 2015  Mattias Andrée <maandree@member.fsf.org>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include "common.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#if defined(__linux__) && !defined(NO_IO_URING)
+# include <linux/io_uring.h>
+# include <linux/stat.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#  define HAVE_IO_URING
+# endif
+#endif
+
+
+
+#ifdef HAVE_IO_URING
+
+/**
+ * The maximum number of submission queue entries.
+ */
+#define RING_ENTRIES  256
+
+
+
+/**
+ * An io_uring instance.
+ */
+struct file_ring {
+	/**
+	 * The file descriptor of the instance.
+	 */
+	int fd;
+
+	/**
+	 * The mapped submission queue ring.
+	 */
+	void *sq;
+
+	/**
+	 * The size of `sq`.
+	 */
+	size_t sq_size;
+
+	/**
+	 * The mapped completion queue ring,
+	 * may be the same as `sq`.
+	 */
+	void *cq;
+
+	/**
+	 * The size of `cq`.
+	 */
+	size_t cq_size;
+
+	/**
+	 * The mapped submission queue entries.
+	 */
+	struct io_uring_sqe *sqes;
+
+	/**
+	 * The number of elements in `sqes`.
+	 */
+	unsigned entries;
+
+	/**
+	 * The ring's parameters.
+	 */
+	struct io_uring_params params;
+
+	/**
+	 * The tail of the submission queue, including
+	 * entries that have not been published yet.
+	 */
+	unsigned tail;
+};
+
+
+
+/**
+ * Get a field in a mapped ring.
+ * 
+ * @param   MAP     The mapped ring.
+ * @param   OFFSET  The offset of the field.
+ * @return          Pointer to the field, as an `unsigned *`.
+ */
+#define RING_FIELD(MAP, OFFSET)  ((unsigned *)(void *)((char *)(MAP) + (OFFSET)))
+
+
+
+/**
+ * Release the resources of an io_uring instance. The
+ * instance is left with `fd` set to -1, meaning that
+ * io_uring is unavailable.
+ * 
+ * @param  r  The instance.
+ */
+static void ring_close(struct file_ring *r)
+{
+	if (r->sqes != NULL)
+		munmap(r->sqes, r->entries * sizeof(*r->sqes));
+	if ((r->cq != NULL) && (r->cq != r->sq))
+		munmap(r->cq, r->cq_size);
+	if (r->sq != NULL)
+		munmap(r->sq, r->sq_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+
+/**
+ * Create an io_uring instance.
+ * 
+ * @param   r        Output parameter for the instance.
+ * @param   entries  The minimum number of submission queue entries.
+ * @return           0 on success, -1 on error.
+ */
+static int ring_open(struct file_ring *r, unsigned entries)
+{
+	struct io_uring_params *p = &r->params;
+	void *map;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, p);
+	t (r->fd < 0);
+
+	r->sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	r->cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+
+	map = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+	t (map == MAP_FAILED);
+	r->sq = map;
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq = r->sq;
+	} else {
+		map = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+		t (map == MAP_FAILED);
+		r->cq = map;
+	}
+	map = mmap(NULL, p->sq_entries * sizeof(*r->sqes), PROT_READ | PROT_WRITE,
+	           MAP_SHARED, r->fd, IORING_OFF_SQES);
+	t (map == MAP_FAILED);
+	r->sqes = map;
+	r->entries = p->sq_entries;
+	r->tail = *RING_FIELD(r->sq, p->sq_off.tail);
+	return 0;
+
+fail:
+	RETURN (-1)
+	ring_close(r);
+}
+
+
+/**
+ * Get the next submission queue entry. The caller
+ * must not queue more entries than the ring has
+ * between calls to ring_run().
+ * 
+ * @param   r          The instance.
+ * @param   opcode     The operation.
+ * @param   user_data  Value to identify the completion by.
+ * @return             The entry, zeroed except for `opcode`
+ *                     and `user_data`.
+ */
+static struct io_uring_sqe *ring_get(struct file_ring *r, unsigned char opcode, uint64_t user_data)
+{
+	unsigned mask = *RING_FIELD(r->sq, r->params.sq_off.ring_mask);
+	unsigned i = r->tail++ & mask;
+	struct io_uring_sqe *sqe = r->sqes + i;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = user_data;
+	RING_FIELD(r->sq, r->params.sq_off.array)[i] = i;
+	return sqe;
+}
+
+
+/**
+ * Submit all queued entries and wait for their completion.
+ * 
+ * @param   r         The instance.
+ * @param   n         The number of queued entries.
+ * @param   complete  Function called with `data`, the `user_data`
+ *                    and the result of each completed entry.
+ * @param   data      User-defined data for `complete`.
+ * @return            0 on success, -1 on error.
+ */
+static int ring_run(struct file_ring *r, unsigned n, void (*complete)(void *, uint64_t, int), void *data)
+{
+	unsigned *sq_head = RING_FIELD(r->sq, r->params.sq_off.head);
+	unsigned *sq_tail = RING_FIELD(r->sq, r->params.sq_off.tail);
+	unsigned *cq_head = RING_FIELD(r->cq, r->params.cq_off.head);
+	unsigned *cq_tail = RING_FIELD(r->cq, r->params.cq_off.tail);
+	unsigned cq_mask = *RING_FIELD(r->cq, r->params.cq_off.ring_mask);
+	struct io_uring_cqe *cqes = (void *)((char *)(r->cq) + r->params.cq_off.cqes);
+	struct io_uring_cqe *cqe;
+	unsigned head, to_submit;
+	long ret;
+
+	__atomic_store_n(sq_tail, r->tail, __ATOMIC_RELEASE);
+
+	while (n) {
+		head = *cq_head;
+		for (; n && head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE); head++, n--) {
+			cqe = cqes + (head & cq_mask);
+			complete(data, cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+		if (!n)
+			break;
+		to_submit = r->tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		ret = syscall(__NR_io_uring_enter, r->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		t (ret < 0 && errno != EINTR);
+	}
+	return 0;
+
+fail:
+	return -1;
+}
+
+
+/**
+ * The state of a batch of files being opened.
+ */
+struct batch {
+	/**
+	 * The files.
+	 */
+	struct file_open *files;
+
+	/**
+	 * For each file, its status, if `stat_ok`.
+	 */
+	struct statx *st;
+
+	/**
+	 * For each file, did statx(2) succeed?
+	 */
+	char *stat_ok;
+
+	/**
+	 * Did the kernel reject an operation
+	 * because it does not support it?
+	 */
+	int unsupported;
+};
+
+
+/**
+ * Record the result of an opening.
+ * 
+ * @param  data:struct batch *  The batch.
+ * @param  user_data            The index of the file.
+ * @param  res                  The result.
+ */
+static void opened(void *data, uint64_t user_data, int res)
+{
+	struct batch *b = data;
+
+	if (res == -EINVAL)
+		b->unsupported = 1;
+	b->files[user_data].fd = res < 0 ? -1 : res;
+}
+
+
+/**
+ * Record the result of a statx(2).
+ * 
+ * @param  data:struct batch *  The batch.
+ * @param  user_data            The index of the file.
+ * @param  res                  The result.
+ */
+static void stated(void *data, uint64_t user_data, int res)
+{
+	struct batch *b = data;
+
+	if (res == -EINVAL)
+		b->unsupported = 1;
+	b->stat_ok[user_data] = !res;
+}
+
+
+/**
+ * Open files with io_uring, at most `r->entries` files
+ * at a time. The files are first opened, and then
+ * stat:ed through their file descriptors, with one
+ * system call for each.
+ * 
+ * @param   r      The instance.
+ * @param   files  The files, `fd` shall be -1 for each file.
+ * @param   n      The number of elements in `files`.
+ * @return         0 on success, -1 on error, in
+ *                 which case no file is open.
+ */
+static int open_with_ring(struct file_ring *r, struct file_open *files, size_t n)
+{
+	struct batch b;
+	struct io_uring_sqe *sqe;
+	size_t i, j, m, max = r->entries;
+	unsigned stats;
+
+	b.unsupported = 0;
+	b.st = malloc(max * sizeof(*b.st));
+	b.stat_ok = malloc(max);
+	t (!b.st || !b.stat_ok);
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < max ? n - i : max;
+		b.files = files + i;
+		for (j = 0; j < m; j++) {
+			sqe = ring_get(r, IORING_OP_OPENAT, j);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uint64_t)(uintptr_t)(files[i + j].path);
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		t (ring_run(r, (unsigned)m, opened, &b));
+
+		/* Stat the opened files, rather than their pathnames,
+		 * in case the files were replaced after being opened. */
+		for (j = stats = 0; j < m; j++) {
+			b.stat_ok[j] = 0;
+			if (files[i + j].fd < 0)
+				continue;
+			sqe = ring_get(r, IORING_OP_STATX, j);
+			sqe->fd = files[i + j].fd;
+			sqe->addr = (uint64_t)(uintptr_t)"";
+			sqe->statx_flags = AT_EMPTY_PATH;
+			sqe->len = STATX_TYPE | STATX_SIZE;
+			sqe->addr2 = (uint64_t)(uintptr_t)(b.st + j);
+			stats++;
+		}
+		if (stats && ring_run(r, stats, stated, &b))
+			b.unsupported = 1;
+
+		for (j = 0; j < m; j++) {
+			if (files[i + j].fd < 0)
+				continue;
+			if (b.unsupported || !b.stat_ok[j] || ((b.st[j].stx_mode & S_IFMT) != S_IFREG) ||
+			    (b.st[j].stx_size > (uint64_t)SIZE_MAX)) {
+				close(files[i + j].fd);
+				files[i + j].fd = -1;
+				continue;
+			}
+			files[i + j].size = (size_t)(b.st[j].stx_size);
+		}
+		if (b.unsupported) {
+			errno = ENOSYS;
+			goto fail;
+		}
+	}
+
+	free(b.st);
+	free(b.stat_ok);
+	return 0;
+
+fail:
+	RETURN (-1) {
+	for (i = 0; i < n; i++) {
+		if (files[i].fd >= 0)
+			close(files[i].fd);
+		files[i].fd = -1;
+	}
+	free(b.st);
+	free(b.stat_ok);
+	}
+}
+
+#endif
+
+
+/**
+ * Open regular files and get their sizes, all at once,
+ * with io_uring. The io_uring instance is created on
+ * the first call and reused by later calls.
+ * 
+ * @param   ring   The io_uring instance, `*ring` shall be `NULL`
+ *                 before the first call. It shall be released
+ *                 with librarian__close_ring().
+ * @param   files  The files, `fd` and `size` are set for each
+ *                 regular file that could be opened. Other
+ *                 files are ignored, with `fd` set to -1.
+ * @param   n      The number of elements in `files`.
+ * @return         0 on success, -1 if io_uring is unavailable,
+ *                 in which case no file is open.
+ */
+int librarian__open_files(struct file_ring **ring, struct file_open *files, size_t n)
+{
+#ifdef HAVE_IO_URING
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		files[i].fd = -1;
+	if (*ring == NULL) {
+		*ring = malloc(sizeof(**ring));
+		t (*ring == NULL);
+		/* On failure, the instance is left unavailable. */
+		ring_open(*ring, RING_ENTRIES);
+	}
+	if ((*ring)->fd < 0) {
+		errno = ENOSYS;
+		goto fail;
+	}
+	if (open_with_ring(*ring, files, n)) {
+		/* Completions may still be pending, so the
+		 * instance cannot be used again. */
+		ring_close(*ring);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	return -1;
+#else
+	(void) ring;
+	(void) files;
+	(void) n;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Release an io_uring instance created by librarian__open_files().
+ * 
+ * @param  ring  The instance, may be `NULL`.
+ */
+void librarian__close_ring(struct file_ring *ring)
+{
+#ifdef HAVE_IO_URING
+	if (ring != NULL)
+		ring_close(ring);
+#endif
+	free(ring);
+}
@@ -30,10 +30,15 @@
 #define  t(...)  do { if (__VA_ARGS__) goto fail; } while (0)
 
 
+/* The function REALLOC() uses, may be defined before including this file. */
+#ifndef REALLOC_FUNCTION
+# define REALLOC_FUNCTION  realloc
+#endif
+
 #define REALLOC(PTR, SIZE)  \
 	do {  \
 		void *new__;  \
-		new__ = realloc(PTR, (SIZE) * sizeof(*(PTR)));  \
+		new__ = REALLOC_FUNCTION(PTR, (SIZE) * sizeof(*(PTR)));  \
 		t (new__ == NULL);  \
 		(PTR) = new__;  \
 	} while (0)